@@ -6,6 +6,12 @@
 #define DEBUG_TOOL "gf2"
 #define COMPILER_TOOL "clang"
 
+typedef struct{
+    char **elems;
+    size_t count;
+    size_t capacity;
+} Compile_Flags;
+
 typedef struct{
     char **elems;
     size_t count;
@@ -18,6 +24,7 @@ static bool build(
         Noh_File_Paths *update_check_paths,
         char *input_path,
         char *output_path,
+        Compile_Flags *compile_flags,
         Linker_Params *linker_params) {
     bool result = true;
 
@@ -33,6 +40,11 @@ static bool build(
 
     // c-flags
     noh_cmd_append(cmd, "-Wall", "-Wextra", "-ggdb");
+    if (compile_flags) {
+        for (size_t i = 0; i < compile_flags->count; i++) {
+            noh_cmd_append(cmd, compile_flags->elems[i]);
+        }
+    }
 
     // Output
     if (noh_sv_ends_with(noh_sv_from_cstr(output_path), noh_sv_from_cstr(".o"))) {
@@ -58,15 +70,17 @@ defer:
     noh_arena_reset(arena);
     noh_cmd_reset(cmd);
     noh_da_reset(update_check_paths);
+    if (compile_flags) noh_da_reset(compile_flags);
     if (linker_params) noh_da_reset(linker_params);
     return result;
 }
 
 bool build_noh(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
     noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./noh_bld.h");
     noh_da_append(ucp, "./src/noh.c");
 
-    return build(arena, cmd, ucp, "noh.c", "libnoh.o", NULL);
+    return build(arena, cmd, ucp, "noh.c", "libnoh.o", NULL, NULL);
 }
 
 bool build_common(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
@@ -74,53 +88,272 @@ bool build_common(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
     noh_da_append(ucp, "./src/common.h");
     noh_da_append(ucp, "./src/common.c");
 
-    return build(arena, cmd, ucp, "common.c", "libcommon.o", NULL);
+    return build(arena, cmd, ucp, "common.c", "libcommon.o", NULL, NULL);
+}
+
+bool build_intern(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/intern.h");
+    noh_da_append(ucp, "./src/intern.c");
+
+    // Depends on libnoh.o
+
+    return build(arena, cmd, ucp, "intern.c", "libintern.o", NULL, NULL);
 }
 
 bool build_lexer(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
     noh_da_append(ucp, "./src/noh.h");
     noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
     noh_da_append(ucp, "./src/lexer.h");
     noh_da_append(ucp, "./src/lexer.c");
 
-    // Depends on libnoh.o
+    // Depends on libnoh.o, libintern.o
 
-    return build(arena, cmd, ucp, "lexer.c", "liblexer.o", NULL);
+    return build(arena, cmd, ucp, "lexer.c", "liblexer.o", NULL, NULL);
+}
+
+bool build_layout(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/layout.h");
+    noh_da_append(ucp, "./src/layout.c");
+
+    // Depends on libnoh.o, liblexer.o
+
+    return build(arena, cmd, ucp, "layout.c", "liblayout.o", NULL, NULL);
 }
 
 bool build_parser(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
     noh_da_append(ucp, "./src/noh.h");
     noh_da_append(ucp, "./src/common.h");
     noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/layout.h");
     noh_da_append(ucp, "./src/parser.h");
     noh_da_append(ucp, "./src/parser.c");
 
+    // Depends on libnoh.o, liblexer.o, liblayout.o
+
+    return build(arena, cmd, ucp, "parser.c", "libparser.o", NULL, NULL);
+}
+
+// The sources that determine the format of a cache entry: the tokens, the layout tokens, the nodes of the syntax tree
+// and the layout of the entry itself.
+static char *cache_format_sources[] = {
+    "./src/lexer.h", "./src/lexer.c", "./src/layout.h", "./src/layout.c", "./src/parser.h", "./src/parser.c",
+    "./src/cache.h", "./src/cache.c"
+};
+
+// Hashes the sources that determine the cache format into the definition of CACHE_VERSION, so a compiler that is built
+// from different sources never uses the cache entries of another one.
+static char *cache_version_flag(Noh_Arena *arena) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < noh_array_len(cache_format_sources); i++) {
+        Noh_Mapped_File file = {0};
+        if (!noh_mapped_file_open(&file, cache_format_sources[i])) return NULL;
+        for (size_t j = 0; j < file.count; j++) hash = (hash ^ (uint8_t)file.elems[j]) * 1099511628211ull;
+        noh_mapped_file_close(&file);
+    }
+
+    return noh_arena_sprintf(arena, "-DCACHE_VERSION=0x%016llxull", (unsigned long long)hash);
+}
+
+bool build_cache(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
+    for (size_t i = 0; i < noh_array_len(cache_format_sources); i++) noh_da_append(ucp, cache_format_sources[i]);
+
+    // Depends on libnoh.o, libintern.o
+
+    char *version_flag = cache_version_flag(arena);
+    if (version_flag == NULL) return false;
+    Compile_Flags flags = {0};
+    noh_da_append(&flags, version_flag);
+    bool result = build(arena, cmd, ucp, "cache.c", "libcache.o", &flags, NULL);
+    noh_da_free(&flags);
+    return result;
+}
+
+bool build_include(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
+    noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/layout.h");
+    noh_da_append(ucp, "./src/parser.h");
+    noh_da_append(ucp, "./src/include.h");
+    noh_da_append(ucp, "./src/include.c");
+
+    // Depends on libnoh.o, libintern.o, liblexer.o, liblayout.o, libparser.o
+
+    return build(arena, cmd, ucp, "include.c", "libinclude.o", NULL, NULL);
+}
+
+bool build_emit(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/emit.h");
+    noh_da_append(ucp, "./src/emit.c");
+
+    // Depends on libnoh.o
+
+    return build(arena, cmd, ucp, "emit.c", "libemit.o", NULL, NULL);
+}
+
+bool build_codegen(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
+    noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/parser.h");
+    noh_da_append(ucp, "./src/include.h");
+    noh_da_append(ucp, "./src/emit.h");
+    noh_da_append(ucp, "./src/codegen.h");
+    noh_da_append(ucp, "./src/codegen.c");
+
+    // Depends on libnoh.o, libintern.o, libparser.o, libinclude.o, libemit.o
+
+    return build(arena, cmd, ucp, "codegen.c", "libcodegen.o", NULL, NULL);
+}
+
+bool build_compile(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./noh_bld.h");
+    noh_da_append(ucp, "./src/compile.h");
+    noh_da_append(ucp, "./src/compile.c");
+
     // Depends on libnoh.o
 
-    return build(arena, cmd, ucp, "parser.c", "libparser.o", NULL);
+    return build(arena, cmd, ucp, "compile.c", "libcompile.o", NULL, NULL);
 }
 
 bool build_cropr(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp, Linker_Params *lp) {
     // First build dependencies.
     if (!build_noh(arena, cmd, ucp)) return false;
     if (!build_common(arena, cmd, ucp)) return false;
+    if (!build_intern(arena, cmd, ucp)) return false;
     if (!build_lexer(arena, cmd, ucp)) return false;
+    if (!build_layout(arena, cmd, ucp)) return false;
     if (!build_parser(arena, cmd, ucp)) return false;
+    if (!build_include(arena, cmd, ucp)) return false;
+    if (!build_cache(arena, cmd, ucp)) return false;
+    if (!build_emit(arena, cmd, ucp)) return false;
+    if (!build_codegen(arena, cmd, ucp)) return false;
+    if (!build_compile(arena, cmd, ucp)) return false;
 
     noh_da_append(ucp, "./src/main.c");
     noh_da_append(ucp, "./build/libnoh.o");
     noh_da_append(ucp, "./build/libcommon.o");
+    noh_da_append(ucp, "./build/libintern.o");
     noh_da_append(ucp, "./build/liblexer.o");
+    noh_da_append(ucp, "./build/liblayout.o");
     noh_da_append(ucp, "./build/libparser.o");
+    noh_da_append(ucp, "./build/libinclude.o");
+    noh_da_append(ucp, "./build/libcache.o");
+    noh_da_append(ucp, "./build/libemit.o");
+    noh_da_append(ucp, "./build/libcodegen.o");
+    noh_da_append(ucp, "./build/libcompile.o");
 
     noh_da_append(lp, "-lm");
+    noh_da_append(lp, "-lpthread");
     noh_da_append(lp, "-L./build");
     noh_da_append(lp, "-l:libnoh.o");
     noh_da_append(lp, "-l:libcommon.o");
+    noh_da_append(lp, "-l:libintern.o");
     noh_da_append(lp, "-l:liblexer.o");
+    noh_da_append(lp, "-l:liblayout.o");
     noh_da_append(lp, "-l:libparser.o");
+    noh_da_append(lp, "-l:libinclude.o");
+    noh_da_append(lp, "-l:libcache.o");
+    noh_da_append(lp, "-l:libemit.o");
+    noh_da_append(lp, "-l:libcodegen.o");
+    noh_da_append(lp, "-l:libcompile.o");
+
+    return build(arena, cmd, ucp, "main.c", "cropr", NULL, lp);
+}
+
+// Builds the benchmark binary. All sources are compiled in a single optimized build, separate from the debug objects
+// of cropr, and the allocator is wrapped so the benchmark can count allocations.
+bool build_bench(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    bool result = true;
+
+    char *sources[] = {
+        "./src/bench.c", "./src/noh.c", "./src/common.c", "./src/intern.c", "./src/lexer.c", "./src/layout.c",
+        "./src/parser.c"
+    };
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
+    noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/layout.h");
+    noh_da_append(ucp, "./src/parser.h");
+    for (size_t i = 0; i < noh_array_len(sources); i++) noh_da_append(ucp, sources[i]);
+
+    int needs_rebuild = noh_output_is_older("./build/bench", ucp->elems, ucp->count);
+    if (needs_rebuild < 0) noh_return_defer(false);
+    if (needs_rebuild == 0) {
+        noh_log(NOH_INFO, "bench is up to date.");
+        noh_return_defer(true);
+    }
+
+    noh_cmd_append(cmd, COMPILER_TOOL);
+    noh_cmd_append(cmd, "-Wall", "-Wextra", "-O2", "-ggdb");
+    noh_cmd_append(cmd, "-o", "./build/bench");
+    for (size_t i = 0; i < noh_array_len(sources); i++) noh_cmd_append(cmd, sources[i]);
+    noh_cmd_append(cmd, "-lm", "-lpthread", "-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc");
+
+    if (!noh_cmd_run_sync(*cmd)) noh_return_defer(false);
 
-    return build(arena, cmd, ucp, "main.c", "cropr", lp);
+defer:
+    noh_arena_reset(arena);
+    noh_cmd_reset(cmd);
+    noh_da_reset(ucp);
+    return result;
+}
+
+// Builds the test binary. All sources it tests are compiled along with it in a single build, like the benchmark.
+bool build_test(Noh_Arena *arena, Noh_Cmd *cmd, Noh_File_Paths *ucp) {
+    bool result = true;
+
+    char *sources[] = {
+        "./src/test.c", "./src/noh.c", "./src/common.c", "./src/intern.c", "./src/lexer.c", "./src/layout.c",
+        "./src/parser.c", "./src/include.c", "./src/cache.c", "./src/emit.c", "./src/codegen.c"
+    };
+    noh_da_append(ucp, "./src/noh.h");
+    noh_da_append(ucp, "./src/common.h");
+    noh_da_append(ucp, "./src/intern.h");
+    noh_da_append(ucp, "./src/lexer.h");
+    noh_da_append(ucp, "./src/layout.h");
+    noh_da_append(ucp, "./src/parser.h");
+    noh_da_append(ucp, "./src/include.h");
+    noh_da_append(ucp, "./src/cache.h");
+    noh_da_append(ucp, "./src/emit.h");
+    noh_da_append(ucp, "./src/codegen.h");
+    for (size_t i = 0; i < noh_array_len(sources); i++) noh_da_append(ucp, sources[i]);
+
+    int needs_rebuild = noh_output_is_older("./build/test", ucp->elems, ucp->count);
+    if (needs_rebuild < 0) noh_return_defer(false);
+    if (needs_rebuild == 0) {
+        noh_log(NOH_INFO, "test is up to date.");
+        noh_return_defer(true);
+    }
+
+    noh_cmd_append(cmd, COMPILER_TOOL);
+    char *version_flag = cache_version_flag(arena);
+    if (version_flag == NULL) noh_return_defer(false);
+    noh_cmd_append(cmd, "-Wall", "-Wextra", "-O1", "-ggdb", version_flag);
+    noh_cmd_append(cmd, "-o", "./build/test");
+    for (size_t i = 0; i < noh_array_len(sources); i++) noh_cmd_append(cmd, sources[i]);
+    noh_cmd_append(cmd, "-lm", "-lpthread");
+
+    if (!noh_cmd_run_sync(*cmd)) noh_return_defer(false);
+
+defer:
+    noh_arena_reset(arena);
+    noh_cmd_reset(cmd);
+    noh_da_reset(ucp);
+    return result;
 }
 
 void print_usage(char *program) {
@@ -129,6 +362,8 @@ void print_usage(char *program) {
     noh_log(NOH_INFO, "- build: build cropr (default).");
     noh_log(NOH_INFO, "- run: build and run cropr.");
     noh_log(NOH_INFO, "- test: build and run tests.");
+    noh_log(NOH_INFO, "- bench [size in MB] [threads] [shape...]: build and run the lexer and parser benchmarks.");
+    noh_log(NOH_INFO, "    Shapes: ident, strings, indent, preproc (default all). Size defaults to 32, threads to 1.");
     noh_log(NOH_INFO, "- debug: build and debug cropr using the defined debug tool.");
     noh_log(NOH_INFO, "- clean: clean all build artifacts.");
 }
@@ -183,9 +418,30 @@ int main(int argc, char **argv) {
         noh_cmd_free(&cmd);
 
     } else if (strcmp(command, "test") == 0) {
-        // run tests
-        printf("Tests not yet implemented.\n");
-        return 1;
+        // Build and run the tests.
+        if (!build_test(&arena, &cmd, &ucp)) return 1;
+
+        Noh_Cmd cmd = {0};
+        noh_cmd_append(&cmd, "./build/test");
+        if (!noh_cmd_run_sync(cmd)) return 1;
+        noh_cmd_free(&cmd);
+
+    } else if (strcmp(command, "bench") == 0) {
+        // Build the benchmark, and run it for every shape in its own process.
+        if (!build_bench(&arena, &cmd, &ucp)) return 1;
+
+        char *size = argc > 0 ? noh_shift_args(&argc, &argv) : "32";
+        char *threads = argc > 0 ? noh_shift_args(&argc, &argv) : "1";
+        char *all_shapes[] = { "ident", "strings", "indent", "preproc" };
+        char **shapes = argc > 0 ? argv : all_shapes;
+        size_t shape_count = argc > 0 ? (size_t)argc : noh_array_len(all_shapes);
+
+        for (size_t i = 0; i < shape_count; i++) {
+            Noh_Cmd cmd = {0};
+            noh_cmd_append(&cmd, "./build/bench", shapes[i], size, threads);
+            if (!noh_cmd_run_sync(cmd)) return 1;
+            noh_cmd_free(&cmd);
+        }
 
     } else if (strcmp(command, "clean") == 0) {
         Noh_Cmd cmd = {0};
@@ -24,9 +24,10 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-// Ensure that noh.h is available.
-#ifndef NOH_IMPLEMENTATION
-#error "Please include noh.h with implementation!"
+// Ensure that noh.h is available. The implementation needs the implementation of noh.h, either in the same file or
+// linked in.
+#ifndef NOH_H_
+#error "Please include noh.h first!"
 #else
 
 #ifndef NOH_BLD_H_
@@ -57,6 +58,15 @@
     #define NOH_INVALID_PROC (-1)
 #endif // _WIN32
 
+// File descriptors.
+#ifdef _WIN32
+    typedef HANDLE Noh_Fd;
+    #define NOH_INVALID_FD INVALID_HANDLE_VALUE
+#else
+    typedef int Noh_Fd;
+    #define NOH_INVALID_FD (-1)
+#endif // _WIN32
+
 // A collection of processes.
 typedef struct {
     Noh_Pid *elems;
@@ -100,6 +110,11 @@ noh_da_append_multiple(          \
 // Runs a command asynchronously and returns the process id.
 Noh_Pid noh_cmd_run_async(Noh_Cmd cmd);
 
+// Runs a command asynchronously with its standard input read from the specified file, and returns the process id.
+// The file stays open in the calling process. If it is the read end of a pipe, the write end should not be inherited
+// by the command, otherwise the command never sees the end of its input.
+Noh_Pid noh_cmd_run_async_stdin(Noh_Cmd cmd, Noh_Fd fdin);
+
 // Runs a command synchronously.
 bool noh_cmd_run_sync(Noh_Cmd cmd);
 
@@ -108,11 +123,8 @@ void noh_cmd_render(Noh_Cmd cmd, Noh_String *string);
 
 ///////////////////////// Building /////////////////////////
 
-#ifdef _WIN32
-bool noh_bld_exit_on_rebuild_fail = true;
-#else
-bool noh_bld_exit_on_rebuild_fail = false;
-#endif // _WIN32
+// Whether a build script exits instead of rebuilding itself when its source changed.
+extern bool noh_bld_exit_on_rebuild_fail;
 
 
 // Call this macro at the start of a build script. It will check if the source file is newer than the executable
@@ -162,6 +174,12 @@ int noh_output_is_older(const char *output_path, char **input_paths, size_t inpu
 
 #ifdef NOH_BLD_IMPLEMENTATION
 
+#ifdef _WIN32
+bool noh_bld_exit_on_rebuild_fail = true;
+#else
+bool noh_bld_exit_on_rebuild_fail = false;
+#endif // _WIN32
+
 ///////////////////////// Processes /////////////////////////
 
 bool noh_proc_wait(Noh_Pid pid)
@@ -248,6 +266,10 @@ void noh_cmd_render(Noh_Cmd cmd, Noh_String *string) {
 }
 
 Noh_Pid noh_cmd_run_async(Noh_Cmd cmd) {
+    return noh_cmd_run_async_stdin(cmd, NOH_INVALID_FD);
+}
+
+Noh_Pid noh_cmd_run_async_stdin(Noh_Cmd cmd, Noh_Fd fdin) {
     if (cmd.count < 1) {
         noh_log(NOH_ERROR, "Cannot run an empty command.");
         return NOH_INVALID_PROC;
@@ -266,7 +288,7 @@ Noh_Pid noh_cmd_run_async(Noh_Cmd cmd) {
     STARTUPINFO suInfo;
     ZeroMemory(&suInfo, sizeof(STARTUPINFO));
     suInfo.cb = sizeof(STARTUPINFO);
-    suInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    suInfo.hStdInput = fdin == NOH_INVALID_FD ? GetStdHandle(STD_INPUT_HANDLE) : fdin;
     suInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
     suInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
     suInfo.dwFlags |= STARTF_USESTDHANDLES;
@@ -296,6 +318,11 @@ Noh_Pid noh_cmd_run_async(Noh_Cmd cmd) {
     }
 
     if (cpid == 0) {
+        if (fdin != NOH_INVALID_FD && dup2(fdin, STDIN_FILENO) < 0) {
+            noh_log(NOH_ERROR, "Could not redirect the input of the child process: %s", strerror(errno));
+            exit(1);
+        }
+
         // NOTE: This leaks a bit of memory in the child process.
         // But do we actually care? It's a one off leak anyway...
         // Create a command that is null terminated.
@@ -388,4 +415,4 @@ int noh_output_is_older(const char *output_path, char **input_paths, size_t inpu
 }
 
 #endif // NOH_BLD_IMPLEMENTATION
-#endif // NOH_IMPLEMENTATION
+#endif // NOH_H_
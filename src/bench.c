@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "noh.h"
+#include "common.h"
+#include "lexer.h"
+#include "layout.h"
+#include "parser.h"
+
+// Allocations are counted by wrapping the allocator with the linker, see build_bench in bld.c. Only calls from the
+// code of the benchmark are wrapped, allocations that libc makes for itself, like in strdup or fopen, are not counted.
+static size_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+// The shapes of the generated corpora, each stresses a different part of the lexer.
+typedef enum {
+    ShapeIdent, // Identifiers, keywords, numbers and symbols.
+    ShapeStrings, // Long string literals.
+    ShapeIndent, // Deeply indented short lines.
+    ShapePreproc, // Preprocessor directives.
+    ShapeCount,
+} Shape;
+
+static const char *shape_names[ShapeCount] = { "ident", "strings", "indent", "preproc" };
+
+static const char *words[] = {
+    "value", "count", "index", "buffer", "result", "node", "next", "left", "right", "size", "data", "item2", "x", "y"
+};
+
+// A xorshift generator, so the corpora are the same on every run.
+static uint32 random_state = 2463534242u;
+static uint32 random_next(uint32 bound) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % bound;
+}
+
+static const char *random_word(void) {
+    return words[random_next(noh_array_len(words))];
+}
+
+// Appends a single line of the specified shape to the corpus.
+static void generate_line(Noh_String *corpus, Shape shape) {
+    switch (shape) {
+        case ShapeIdent: {
+            size_t depth = random_next(3);
+            for (size_t i = 0; i < depth * 4; i++) noh_da_append(corpus, ' ');
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, " = ");
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, random_next(2) ? " + " : " -> ");
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, "(");
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, ", 42) :: return ");
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, " // ");
+            noh_string_append_cstr(corpus, random_word());
+        } break;
+        case ShapeStrings: {
+            noh_string_append_cstr(corpus, "    print(\"");
+            size_t count = 4 + random_next(12);
+            for (size_t i = 0; i < count; i++) {
+                noh_string_append_cstr(corpus, random_word());
+                noh_string_append_cstr(corpus, random_next(8) == 0 ? "\\\" " : " ");
+            }
+            noh_string_append_cstr(corpus, "\", '");
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, "')");
+        } break;
+        case ShapeIndent: {
+            size_t depth = 8 + random_next(32);
+            for (size_t i = 0; i < depth * 4; i++) noh_da_append(corpus, ' ');
+            noh_string_append_cstr(corpus, random_next(2) ? "if " : "return ");
+            noh_string_append_cstr(corpus, random_word());
+        } break;
+        case ShapePreproc: {
+            // Only includes end in the closing bracket, the other directives get a value.
+            const char *suffix = " 12";
+            switch (random_next(4)) {
+                case 0: noh_string_append_cstr(corpus, "#include <"); suffix = ".h>"; break;
+                case 1: noh_string_append_cstr(corpus, "#define "); break;
+                case 2: noh_string_append_cstr(corpus, "#ifdef "); break;
+                case 3: noh_string_append_cstr(corpus, "#pragma "); break;
+            }
+            noh_string_append_cstr(corpus, random_word());
+            noh_string_append_cstr(corpus, suffix);
+        } break;
+        default: noh_assert(false && "Unknown shape.");
+    }
+
+    noh_da_append(corpus, '\n');
+}
+
+// Generates a corpus of approximately the specified size and writes it to a file.
+static bool generate_corpus(const char *path, Shape shape, size_t size) {
+    bool result = true;
+    Noh_String corpus = {0};
+    FILE *file = NULL;
+
+    while (corpus.count < size) generate_line(&corpus, shape);
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        noh_log(NOH_ERROR, "Could not open file %s: %s", path, strerror(errno));
+        noh_return_defer(false);
+    }
+    if (fwrite(corpus.elems, 1, corpus.count, file) != corpus.count) {
+        noh_log(NOH_ERROR, "Could not write file %s: %s", path, strerror(errno));
+        noh_return_defer(false);
+    }
+
+defer:
+    if (file) fclose(file);
+    noh_string_free(&corpus);
+    return result;
+}
+
+// The number of times every corpus is lexed and parsed, the fastest run is reported.
+#define BENCH_RUNS 5
+
+static double seconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Generates a corpus in a child process, so the memory used to build it does not count towards the peak RSS of the
+// benchmark itself.
+static bool generate_corpus_apart(const char *path, Shape shape, size_t size) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        noh_log(NOH_ERROR, "Could not fork: %s", strerror(errno));
+        return false;
+    }
+    if (pid == 0) _exit(generate_corpus(path, shape, size) ? 0 : 1);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        noh_log(NOH_ERROR, "Could not wait for the corpus generator: %s", strerror(errno));
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Usage: bench <shape> [size in MB] [threads]
+// Generates a corpus of the shape, then lexes and parses it several times and reports the best run. Every shape is
+// benchmarked in its own process, so the peak RSS is that of a single shape. It includes the pages of the corpus file
+// that are mapped in, but not the generation of the corpus.
+int main(int argc, char **argv) {
+    char *program_name = noh_shift_args(&argc, &argv);
+    if (argc < 1) {
+        noh_log(NOH_ERROR, "Usage: %s <shape> [size in MB] [threads]", program_name);
+        return 1;
+    }
+
+    char *shape_name = noh_shift_args(&argc, &argv);
+    Shape shape = ShapeCount;
+    for (size_t i = 0; i < ShapeCount; i++) {
+        if (strcmp(shape_name, shape_names[i]) == 0) shape = i;
+    }
+    if (shape == ShapeCount) {
+        noh_log(NOH_ERROR, "Unknown shape '%s', available shapes: ident, strings, indent, preproc.", shape_name);
+        return 1;
+    }
+    size_t size_mb = argc > 0 ? strtoul(noh_shift_args(&argc, &argv), NULL, 10) : 32;
+    size_t threads = argc > 0 ? strtoul(noh_shift_args(&argc, &argv), NULL, 10) : 1;
+
+    Noh_Arena arena = noh_arena_init(10 KB);
+    char *path = noh_arena_sprintf(&arena, "./build/corpora/%s.cr", shape_name);
+    if (!noh_mkdir_if_needed("./build/corpora")) return 1;
+    if (!generate_corpus_apart(path, shape, size_mb MB)) return 1;
+
+    uint32 file_id;
+    if (!source_file_open(path, &file_id)) return 1;
+    double size = source_file_get(file_id)->content.count;
+
+    double lex_best = 0;
+    double parse_best = 0;
+    double lazy_best = 0;
+    size_t token_count = 0;
+    size_t lex_allocations = 0;
+    size_t parse_allocations = 0;
+    for (size_t run = 0; run < BENCH_RUNS; run++) {
+        Tokens tokens = {0};
+        Errors errors = {0};
+        LexOptions options = { .keep_trivia = false, .trivia = NULL, .threads = threads };
+
+        size_t before = allocations;
+        double start = seconds_now();
+        lex_file(file_id, &tokens, &errors, options);
+        double lexed = seconds_now();
+        lex_allocations = allocations - before;
+
+        before = allocations;
+        Noh_Arena parse_arena = noh_arena_init(1 MB);
+        Tokens layout = {0};
+        double parse_start = seconds_now();
+        layout_tokens(tokens, &layout, &errors);
+        parse_file(&parse_arena, layout, &errors, (ParseOptions) { .threads = threads });
+        double parsed = seconds_now();
+        parse_allocations = allocations - before;
+
+        // Parse again with lazy bodies, which only parses the signatures.
+        noh_arena_reset(&parse_arena);
+        Errors lazy_errors = {0};
+        double lazy_start = seconds_now();
+        parse_file(&parse_arena, layout, &lazy_errors, (ParseOptions) { .threads = threads, .lazy_bodies = true });
+        double lazy_parsed = seconds_now();
+
+        if (run == 0 || lexed - start < lex_best) lex_best = lexed - start;
+        if (run == 0 || parsed - parse_start < parse_best) parse_best = parsed - parse_start;
+        if (run == 0 || lazy_parsed - lazy_start < lazy_best) lazy_best = lazy_parsed - lazy_start;
+        token_count = tokens.count;
+
+        noh_da_free(&lazy_errors);
+        noh_arena_free(&parse_arena);
+        tokens_free(&layout);
+        tokens_free(&tokens);
+        noh_da_free(&errors);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // The allocation counts miss the allocations that libc makes internally, see __wrap_malloc.
+    printf("%-8s %7.1f MB | lex %8.1f MB/s %8.2f Mtokens/s %8zu allocs | parse %10.1f MB/s %8zu allocs | "
+           "signatures %10.1f MB/s | peak RSS %6ld MB\n",
+           shape_name, size / 1e6, size / lex_best / 1e6, token_count / lex_best / 1e6, lex_allocations,
+           size / parse_best / 1e6, parse_allocations, size / lazy_best / 1e6, usage.ru_maxrss / 1024);
+
+    source_files_free();
+    noh_arena_free(&arena);
+    return 0;
+}
@@ -0,0 +1,385 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "noh.h"
+#include "intern.h"
+#include "cache.h"
+
+// The version of the cache format is a hash of the sources that determine it, which is passed in by bld.c. Entries of
+// a compiler that is built from different sources are then never used.
+#ifndef CACHE_VERSION
+#error "CACHE_VERSION is not defined, build with bld.c."
+#endif // CACHE_VERSION
+
+#define CACHE_MAGIC "CRPC"
+
+// The sections of a cache entry. Every section is an array that starts at an offset from the start of the entry that
+// is a multiple of 8, so the entry can be mapped into memory and read in place wherever it is mapped.
+typedef enum {
+    SectionTokenTypes,
+    SectionTokenOffsets,
+    SectionTokenLengths,
+    SectionTokenPayloads,
+    SectionLayoutTypes,
+    SectionLayoutOffsets,
+    SectionLayoutLengths,
+    SectionLayoutPayloads,
+    SectionLineStarts,
+    SectionStringOffsets, // Where every string starts in the string bytes, followed by where the last one ends.
+    SectionStringBytes,
+    SectionNodeKinds,
+    SectionNodeData,
+    SectionChildren,
+    SectionContent, // The content of the source file, which is compared to be sure the entry belongs to the file.
+    SectionCount,
+} CacheSection;
+
+// The header at the start of a cache entry.
+typedef struct {
+    char magic[4];
+    uint32 root;
+    uint64 version;
+    uint64 content_hash;
+    uint64 content_size;
+    uint32 token_count;
+    uint32 layout_count;
+    uint32 line_count;
+    uint32 string_count;
+    uint32 node_count;
+    uint32 child_count;
+    uint64 offsets[SectionCount];
+    uint64 sizes[SectionCount];
+} CacheHeader;
+
+// The strings of the identifiers and string literals in a cache entry, each string is only stored once.
+typedef struct {
+    Atom *elems;
+    size_t count;
+    size_t capacity;
+} StringPool;
+
+// Hashes the content of a file to find its cache entry. This is FNV-1a, applied to 8 bytes at a time with the high bits
+// folded back after every step, which is several times faster than a byte at a time for large files. Files with the
+// same hash share an entry, which is why an entry also holds the content that it belongs to.
+static uint64 content_hash(Noh_String_View content) {
+    uint64 hash = 14695981039346656037ull ^ content.count;
+    size_t i = 0;
+    for (; i + 8 <= content.count; i += 8) {
+        uint64 word;
+        memcpy(&word, content.elems + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < content.count; i++) hash = (hash ^ (uint8)content.elems[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Identifiers and string literals have an atom as payload, which only means something in the current intern pool.
+// In a cache entry their payload is the index of their string in the string pool of the entry instead.
+static bool payload_is_atom(uint8 type) {
+    return type == TokenIdentifier || type == TokenStringLiteral;
+}
+
+static char *cache_path(Noh_Arena *arena, uint64 hash) {
+    return noh_arena_sprintf(arena, CACHE_DIR "/%016llx-%016llx.crc", (unsigned long long)hash,
+                             (unsigned long long)CACHE_VERSION);
+}
+
+char *cache_entry_path(Noh_Arena *arena, uint32 file_id) {
+    return cache_path(arena, content_hash(source_file_get(file_id)->content));
+}
+
+// Creates a directory of the cache if it does not exist, unlike noh_mkdir_if_needed this does not log on every run.
+static bool cache_mkdir(const char *path) {
+    if (mkdir(path, 0755) == 0 || errno == EEXIST) return true;
+
+    noh_log(NOH_ERROR, "Could not create directory '%s': %s", path, strerror(errno));
+    return false;
+}
+
+// Appends a section to a cache entry that is being written.
+static void cache_add_section(Noh_String *entry, CacheSection section, const void *data, size_t size) {
+    while (entry->count % 8 != 0) noh_da_append(entry, 0);
+
+    CacheHeader *header = (CacheHeader *)entry->elems;
+    header->offsets[section] = entry->count;
+    header->sizes[section] = size;
+    if (size > 0) noh_da_append_multiple(entry, (const char *)data, size);
+}
+
+// Converts the payloads of a token stream to indices in the string pool, and adds the strings that are not in the
+// pool yet. The pool index of every atom is stored plus one in pool_indices, so 0 means it is not in the pool.
+static uint32 *pool_payloads(Tokens tokens, uint32 *pool_indices, StringPool *pool) {
+    uint32 *payloads = noh_realloc_check(NULL, (tokens.count + 1) * sizeof(uint32));
+    for (size_t i = 0; i < tokens.count; i++) {
+        payloads[i] = tokens.payloads[i];
+        if (!payload_is_atom(tokens.types[i])) continue;
+
+        Atom atom = tokens.payloads[i];
+        if (pool_indices[atom] == 0) {
+            noh_da_append(pool, atom);
+            pool_indices[atom] = pool->count;
+        }
+        payloads[i] = pool_indices[atom] - 1;
+    }
+    return payloads;
+}
+
+bool cache_store(uint32 file_id, Tokens tokens, Tokens layout, Program *program) {
+    bool result = true;
+    Noh_Arena arena = noh_arena_init(1 KB);
+    Noh_String entry = {0};
+    StringPool pool = {0};
+    Noh_String strings = {0};
+    FILE *file = NULL;
+    uint32 *pool_indices = calloc(atoms_count(), sizeof(uint32));
+    noh_assert(pool_indices != NULL && "Could not allocate enough memory");
+    uint32 *token_payloads = pool_payloads(tokens, pool_indices, &pool);
+    uint32 *layout_payloads = pool_payloads(layout, pool_indices, &pool);
+
+    uint32 *string_offsets = noh_realloc_check(NULL, (pool.count + 1) * sizeof(uint32));
+    for (size_t i = 0; i < pool.count; i++) {
+        string_offsets[i] = strings.count;
+        Noh_String_View string = atom_string(pool.elems[i]);
+        noh_da_append_multiple(&strings, string.elems, string.count);
+    }
+    string_offsets[pool.count] = strings.count;
+
+    SourceFile *source = source_file_get(file_id);
+    CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .content_hash = content_hash(source->content),
+        .content_size = source->content.count,
+        .token_count = tokens.count,
+        .layout_count = layout.count,
+        .line_count = source->line_starts.count,
+        .string_count = pool.count,
+        .node_count = program->node_count,
+        .child_count = program->child_count,
+        .root = program->root,
+    };
+    noh_da_append_multiple(&entry, (const char *)&header, sizeof(header));
+
+    cache_add_section(&entry, SectionTokenTypes, tokens.types, tokens.count * sizeof(*tokens.types));
+    cache_add_section(&entry, SectionTokenOffsets, tokens.offsets, tokens.count * sizeof(*tokens.offsets));
+    cache_add_section(&entry, SectionTokenLengths, tokens.lengths, tokens.count * sizeof(*tokens.lengths));
+    cache_add_section(&entry, SectionTokenPayloads, token_payloads, tokens.count * sizeof(uint32));
+    cache_add_section(&entry, SectionLayoutTypes, layout.types, layout.count * sizeof(*layout.types));
+    cache_add_section(&entry, SectionLayoutOffsets, layout.offsets, layout.count * sizeof(*layout.offsets));
+    cache_add_section(&entry, SectionLayoutLengths, layout.lengths, layout.count * sizeof(*layout.lengths));
+    cache_add_section(&entry, SectionLayoutPayloads, layout_payloads, layout.count * sizeof(uint32));
+    cache_add_section(&entry, SectionLineStarts, source->line_starts.elems,
+                      source->line_starts.count * sizeof(*source->line_starts.elems));
+    cache_add_section(&entry, SectionStringOffsets, string_offsets, (pool.count + 1) * sizeof(uint32));
+    cache_add_section(&entry, SectionStringBytes, strings.elems, strings.count);
+    cache_add_section(&entry, SectionNodeKinds, program->kinds, program->node_count * sizeof(*program->kinds));
+    cache_add_section(&entry, SectionNodeData, program->data, program->node_count * sizeof(*program->data));
+    cache_add_section(&entry, SectionChildren, program->children,
+                      program->child_count * sizeof(*program->children));
+    cache_add_section(&entry, SectionContent, source->content.elems, source->content.count);
+
+    if (!cache_mkdir("./build") || !cache_mkdir(CACHE_DIR)) noh_return_defer(false);
+
+    // The entry is written to a temporary file that is then renamed, so a concurrent run never reads half an entry.
+    char *path = cache_path(&arena, header.content_hash);
+    char *temp_path = noh_arena_sprintf(&arena, "%s.%d.tmp", path, (int)getpid());
+    file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        noh_log(NOH_ERROR, "Could not open file %s: %s", temp_path, strerror(errno));
+        noh_return_defer(false);
+    }
+    if (fwrite(entry.elems, 1, entry.count, file) != entry.count) {
+        noh_log(NOH_ERROR, "Could not write file %s: %s", temp_path, strerror(errno));
+        noh_return_defer(false);
+    }
+    fclose(file);
+    file = NULL;
+    if (rename(temp_path, path) < 0) {
+        noh_log(NOH_ERROR, "Could not rename %s to %s: %s", temp_path, path, strerror(errno));
+        remove(temp_path);
+        noh_return_defer(false);
+    }
+
+defer:
+    if (file) fclose(file);
+    free(pool_indices);
+    free(token_payloads);
+    free(layout_payloads);
+    free(string_offsets);
+    noh_da_free(&pool);
+    noh_string_free(&strings);
+    noh_string_free(&entry);
+    noh_arena_free(&arena);
+    return result;
+}
+
+// The cache entries that are mapped into memory, the tokens and programs that are loaded from them point into these.
+typedef struct {
+    Noh_String_View *elems;
+    size_t count;
+    size_t capacity;
+} CacheMappings;
+
+static CacheMappings cache_mappings = {0};
+
+// Maps a cache entry into memory. The mapping is private and writable, so the payloads can be converted in place and
+// the parser can change the program. Only the pages that are written are copied, the rest is read from the file.
+static bool cache_map(const char *path, Noh_String_View *entry) {
+    // A missing entry is the normal case, so it is not reported.
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    *entry = (Noh_String_View) { .elems = data, .count = info.st_size };
+    return true;
+}
+
+// Points a token stream into a cache entry, and converts the string pool indices in its payloads back to atoms. The
+// stream borrows the arrays, so it has no capacity.
+static Tokens cache_read_tokens(char *entry, CacheHeader *header, CacheSection first, uint32 count, uint32 file_id,
+                                Atom *atoms) {
+    Tokens tokens = { .file_id = file_id };
+    if (count == 0) return tokens;
+
+    tokens.count = count;
+    tokens.types = (uint8 *)(entry + header->offsets[first]);
+    tokens.offsets = (uint32 *)(entry + header->offsets[first + 1]);
+    tokens.lengths = (uint32 *)(entry + header->offsets[first + 2]);
+    tokens.payloads = (uint32 *)(entry + header->offsets[first + 3]);
+
+    for (size_t i = 0; i < count; i++) {
+        if (payload_is_atom(tokens.types[i])) tokens.payloads[i] = atoms[tokens.payloads[i]];
+    }
+    return tokens;
+}
+
+// Checks whether a cache entry is complete and belongs to the content, every section should fit in the entry and
+// have the size that the header says.
+static bool cache_entry_valid(Noh_String_View entry, Noh_String_View content, uint64 hash) {
+    if (entry.count < sizeof(CacheHeader)) return false;
+
+    CacheHeader *header = (CacheHeader *)entry.elems;
+    if (memcmp(header->magic, CACHE_MAGIC, 4) != 0 || header->version != CACHE_VERSION) return false;
+    if (header->content_hash != hash || header->content_size != content.count) return false;
+
+    uint64 expected[SectionCount] = {
+        [SectionTokenTypes] = header->token_count * sizeof(uint8),
+        [SectionTokenOffsets] = header->token_count * sizeof(uint32),
+        [SectionTokenLengths] = header->token_count * sizeof(uint32),
+        [SectionTokenPayloads] = header->token_count * sizeof(uint32),
+        [SectionLayoutTypes] = header->layout_count * sizeof(uint8),
+        [SectionLayoutOffsets] = header->layout_count * sizeof(uint32),
+        [SectionLayoutLengths] = header->layout_count * sizeof(uint32),
+        [SectionLayoutPayloads] = header->layout_count * sizeof(uint32),
+        [SectionLineStarts] = header->line_count * sizeof(uint32),
+        [SectionStringOffsets] = (header->string_count + 1) * sizeof(uint32),
+        [SectionStringBytes] = header->sizes[SectionStringBytes],
+        [SectionNodeKinds] = header->node_count * sizeof(uint8),
+        [SectionNodeData] = header->node_count * sizeof(NodeData),
+        [SectionChildren] = header->child_count * sizeof(NodeIndex),
+        [SectionContent] = content.count,
+    };
+    for (size_t i = 0; i < SectionCount; i++) {
+        if (header->sizes[i] != expected[i] || header->offsets[i] % 8 != 0) return false;
+        if (header->offsets[i] > entry.count || header->sizes[i] > entry.count - header->offsets[i]) return false;
+    }
+
+    // Different files can have the same hash, only the entry with the same content belongs to the file.
+    if (content.count > 0 && memcmp(entry.elems + header->offsets[SectionContent], content.elems, content.count) != 0) {
+        return false;
+    }
+
+    return header->root < header->node_count;
+}
+
+bool cache_load(uint32 file_id, Noh_Arena *arena, Tokens *tokens, Tokens *layout, Program **program) {
+    bool result = true;
+    Noh_Arena path_arena = noh_arena_init(1 KB);
+    Noh_String_View mapped = {0};
+    Atom *atoms = NULL;
+
+    SourceFile *source = source_file_get(file_id);
+    uint64 hash = content_hash(source->content);
+    if (!cache_map(cache_path(&path_arena, hash), &mapped)) noh_return_defer(false);
+    if (!cache_entry_valid(mapped, source->content, hash)) noh_return_defer(false);
+
+    char *entry = (char *)mapped.elems;
+    CacheHeader *header = (CacheHeader *)entry;
+
+    // Intern the strings of the pool once, then every payload is converted with a single lookup.
+    const uint32 *string_offsets = (const uint32 *)(entry + header->offsets[SectionStringOffsets]);
+    const char *string_bytes = entry + header->offsets[SectionStringBytes];
+    atoms = noh_realloc_check(NULL, (header->string_count + 1) * sizeof(Atom));
+    for (size_t i = 0; i < header->string_count; i++) {
+        uint32 start = string_offsets[i];
+        uint32 end = string_offsets[i + 1];
+        if (start > end || end > header->sizes[SectionStringBytes]) noh_return_defer(false);
+        atoms[i] = intern((Noh_String_View) { .elems = string_bytes + start, .count = end - start });
+    }
+
+    const uint8 *types[2] = {
+        (const uint8 *)(entry + header->offsets[SectionTokenTypes]),
+        (const uint8 *)(entry + header->offsets[SectionLayoutTypes]),
+    };
+    const uint32 *payloads[2] = {
+        (const uint32 *)(entry + header->offsets[SectionTokenPayloads]),
+        (const uint32 *)(entry + header->offsets[SectionLayoutPayloads]),
+    };
+    uint32 counts[2] = { header->token_count, header->layout_count };
+    for (size_t s = 0; s < 2; s++) {
+        for (size_t i = 0; i < counts[s]; i++) {
+            if (payload_is_atom(types[s][i]) && payloads[s][i] >= header->string_count) noh_return_defer(false);
+        }
+    }
+
+    *tokens = cache_read_tokens(entry, header, SectionTokenTypes, header->token_count, file_id, atoms);
+    *layout = cache_read_tokens(entry, header, SectionLayoutTypes, header->layout_count, file_id, atoms);
+
+    // The line starts are changed when the file is edited, so they are copied.
+    noh_da_reset(&source->line_starts);
+    noh_da_append_multiple(&source->line_starts, (const uint32 *)(entry + header->offsets[SectionLineStarts]),
+                           header->line_count);
+
+    // The arrays of the program are used in place. They have no room to grow, so the parser copies them into the arena
+    // when it adds nodes.
+    Program *loaded = noh_arena_alloc(arena, sizeof(Program));
+    *loaded = (Program) {
+        .kinds = (uint8 *)(entry + header->offsets[SectionNodeKinds]),
+        .data = (NodeData *)(entry + header->offsets[SectionNodeData]),
+        .node_count = header->node_count,
+        .node_capacity = header->node_count,
+        .children = (NodeIndex *)(entry + header->offsets[SectionChildren]),
+        .child_count = header->child_count,
+        .child_capacity = header->child_count,
+        .root = header->root,
+        .tokens = *layout,
+        .arena = arena,
+    };
+    *program = loaded;
+
+    // The entry stays mapped until the cache is closed.
+    noh_da_append(&cache_mappings, mapped);
+    mapped = (Noh_String_View) {0};
+
+defer:
+    free(atoms);
+    if (mapped.elems != NULL) munmap((void *)mapped.elems, mapped.count);
+    noh_arena_free(&path_arena);
+    return result;
+}
+
+void cache_close(void) {
+    for (size_t i = 0; i < cache_mappings.count; i++) {
+        munmap((void *)cache_mappings.elems[i].elems, cache_mappings.elems[i].count);
+    }
+    noh_da_free(&cache_mappings);
+}
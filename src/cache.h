@@ -0,0 +1,30 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "common.h"
+#include "lexer.h"
+#include "parser.h"
+
+// The directory in which cached files are stored.
+#define CACHE_DIR "./build/cache"
+
+// Loads the tokens, layout tokens and program of a source file from the cache, and fills its line starts. The cache
+// entry is found by the hash of the content of the file and the version of the cache format, and holds the content it
+// belongs to, so an entry is never used for a file that changed. The entry is mapped into memory, the tokens borrow
+// their arrays from it and the program uses its arrays in place until they grow. The program is allocated in the
+// arena. Returns false if there is no valid entry, the results are then left untouched.
+bool cache_load(uint32 file_id, Noh_Arena *arena, Tokens *tokens, Tokens *layout, Program **program);
+
+// Stores the tokens, layout tokens and program of a source file in the cache. The tokens should be lexed without
+// trivia, and the file should not have any errors, since errors are not cached.
+// Returns false if the entry could not be written.
+bool cache_store(uint32 file_id, Tokens tokens, Tokens layout, Program *program);
+
+// Gets the path of the cache entry for the current content of a source file, allocated in the arena. The entry does
+// not need to exist.
+char *cache_entry_path(Noh_Arena *arena, uint32 file_id);
+
+// Unmaps all cache entries that were loaded. The tokens and programs loaded from them can no longer be used.
+void cache_close(void);
+
+#endif // _CACHE_H
@@ -0,0 +1,531 @@
+#include <pthread.h>
+
+#include "noh.h"
+#include "intern.h"
+#include "codegen.h"
+
+// The definition of a function, looked up by the atom of its name.
+typedef struct {
+    Program *program; // NULL if there is no definition.
+    NodeIndex node;
+} Definition;
+
+typedef struct {
+    uint32 *elems;
+    size_t count;
+    size_t capacity;
+} ExprStack;
+
+// The state of the code generator while going through a compilation unit.
+typedef struct {
+    Emitter *emitter;
+    Errors *errors;
+    Definition *definitions; // Indexed by atom.
+    size_t definition_count;
+
+    // The expression of the statement that is being generated. The first node of the subexpression that ends at
+    // every node of the expression, relative to the start of the expression.
+    ExprStack starts;
+    ExprStack stack; // The starts of the values while the starts are being determined.
+    ExprStack arguments; // The last node of every argument of the calls that are being generated.
+
+    // The content of the file that token values were read from last.
+    uint32 content_file;
+    Noh_String_View content;
+} Codegen;
+
+// Code that is put before every compilation unit.
+static const char *prelude =
+    "#include <stdbool.h>\n"
+    "#include <stdio.h>\n"
+    "#define printfn printf\n";
+
+static void codegen_error(Codegen *codegen, Program *program, NodeIndex node, const char *message) {
+    Error error = {
+        .message = noh_sv_from_cstr(message),
+        .type = CodegenError,
+        .loc = program_token(program, node).loc
+    };
+    noh_da_append(codegen->errors, error);
+}
+
+// Gets the value of a token of a program. This reads the token arrays directly instead of through tokens_get, since
+// code generation reads the value of nearly every token.
+static Noh_String_View token_value(Codegen *codegen, Program *program, uint32 token) {
+    Tokens *tokens = &program->tokens;
+    if (codegen->content.elems == NULL || tokens->file_id != codegen->content_file) {
+        codegen->content_file = tokens->file_id;
+        codegen->content = source_file_get(tokens->file_id)->content;
+    }
+
+    const char *elems = codegen->content.elems + tokens->offsets[token];
+    return (Noh_String_View) { .elems = elems, .count = tokens->lengths[token] };
+}
+
+// Gets the value of the main token of a node.
+static Noh_String_View node_value(Codegen *codegen, Program *program, NodeIndex node) {
+    return token_value(codegen, program, program->data[node].token);
+}
+
+// Emits a preprocessor directive as it is in the source, up to the end of its line.
+static void emit_preproc(Codegen *codegen, Program *program, NodeIndex node) {
+    Noh_String_View content = source_file_get(program->tokens.file_id)->content;
+    uint32 start = program_token(program, node).loc.offset;
+    const char *end = memchr(content.elems + start, '\n', content.count - start);
+    size_t count = end == NULL ? content.count - start : (size_t)(end - content.elems) - start;
+
+    emit(codegen->emitter, (Noh_String_View) { .elems = content.elems + start, .count = count });
+    emit_char(codegen->emitter, '\n');
+}
+
+// Checks whether a type or parameter is (), which is void in C.
+static bool node_is_unit(Program *program, NodeIndex node) {
+    Token token = program_token(program, node);
+    return token.type == TokenSymbol && token.payload == SymbolUnit;
+}
+
+static void emit_type(Codegen *codegen, Program *program, NodeIndex type) {
+    if (node_is_unit(program, type)) {
+        emit_literal(codegen->emitter, "void");
+        return;
+    }
+
+    for (uint32 i = 0; i < program->data[type].count; i++) {
+        if (i > 0) emit_char(codegen->emitter, ' ');
+        emit(codegen->emitter, token_value(codegen, program, program->data[type].first + i));
+    }
+}
+
+// Gets the number of parameters of a function definition. A single parameter of type () or void means no parameters.
+static uint32 definition_parameters(Program *program, NodeIndex definition) {
+    uint32 count = program->data[definition].count - 1;
+    if (count == 1) {
+        NodeIndex type = program_child(program, definition, 0);
+        Token token = program_token(program, type);
+        if (node_is_unit(program, type) || (token.type == TokenKeyword && token.payload == KeywordVoid
+                                            && program->data[type].count == 1)) return 0;
+    }
+    return count;
+}
+
+// Emits the signature of a function from its definition. The parameters are named after the parameters of the
+// implementation if there is one, otherwise they are left unnamed.
+static void emit_signature(Codegen *codegen, Program *program, NodeIndex definition, Program *impl_program,
+                           NodeIndex implementation) {
+    uint32 type_count = program->data[definition].count;
+    uint32 parameter_count = definition_parameters(program, definition);
+
+    emit_type(codegen, program, program_child(program, definition, type_count - 1));
+    emit_char(codegen->emitter, ' ');
+    emit(codegen->emitter, node_value(codegen, program, definition));
+    emit_char(codegen->emitter, '(');
+    if (parameter_count == 0) emit_literal(codegen->emitter, "void");
+    for (uint32 i = 0; i < parameter_count; i++) {
+        if (i > 0) emit_literal(codegen->emitter, ", ");
+        emit_type(codegen, program, program_child(program, definition, i));
+        if (impl_program != NULL) {
+            emit_char(codegen->emitter, ' ');
+            emit(codegen->emitter, node_value(codegen, impl_program, program_child(impl_program, implementation, i)));
+        }
+    }
+    emit_char(codegen->emitter, ')');
+}
+
+// Determines where the subexpression that ends at every node of an expression starts.
+static void expression_starts(Codegen *codegen, Program *program, NodeIndex first, uint32 count) {
+    noh_da_reset(&codegen->starts);
+    noh_da_reset(&codegen->stack);
+
+    for (uint32 i = 0; i < count; i++) {
+        uint32 operands = 0;
+        switch (program->kinds[first + i]) {
+            case NodeUnary: operands = 1; break;
+            case NodeBinary: operands = 2; break;
+            case NodeCall: operands = program->data[first + i].count + 1; break;
+            default: break;
+        }
+
+        noh_assert(codegen->stack.count >= operands && "Expressions are in postfix order.");
+        uint32 start = i;
+        if (operands > 0) {
+            codegen->stack.count -= operands;
+            start = codegen->stack.elems[codegen->stack.count];
+        }
+        noh_da_append(&codegen->starts, start);
+        noh_da_append(&codegen->stack, start);
+    }
+}
+
+static void emit_expression(Codegen *codegen, Program *program, NodeIndex first, uint32 index);
+
+// Emits an operand of an operator, in parentheses if it has operators itself.
+static void emit_operand(Codegen *codegen, Program *program, NodeIndex first, uint32 index) {
+    NodeKind kind = program->kinds[first + index];
+    bool parens = kind == NodeBinary || kind == NodeUnary;
+    if (parens) emit_char(codegen->emitter, '(');
+    emit_expression(codegen, program, first, index);
+    if (parens) emit_char(codegen->emitter, ')');
+}
+
+// Emits the subexpression that ends at the node at index in the expression that starts at first.
+static void emit_expression(Codegen *codegen, Program *program, NodeIndex first, uint32 index) {
+    NodeIndex node = first + index;
+    Noh_String_View value = node_value(codegen, program, node);
+    Emitter *emitter = codegen->emitter;
+
+    switch (program->kinds[node]) {
+        case NodeIdentifier:
+        case NodeNumberLiteral:
+        case NodeBoolLiteral:
+            emit(emitter, value);
+            break;
+        case NodeStringLiteral:
+            emit_char(emitter, '"');
+            emit(emitter, value);
+            emit_char(emitter, '"');
+            break;
+        case NodeCharLiteral:
+            emit_char(emitter, '\'');
+            emit(emitter, value);
+            emit_char(emitter, '\'');
+            break;
+        case NodeUnit:
+            break;
+        case NodeUnary:
+            emit(emitter, value);
+            emit_operand(codegen, program, first, index - 1);
+            break;
+        case NodeBinary: {
+            uint32 right = index - 1;
+            emit_operand(codegen, program, first, codegen->starts.elems[right] - 1);
+            emit_char(emitter, ' ');
+            emit(emitter, value);
+            emit_char(emitter, ' ');
+            emit_operand(codegen, program, first, right);
+        } break;
+        case NodeCall: {
+            // The arguments come before the call, the last one first when going back from the call.
+            size_t arguments_start = codegen->arguments.count;
+            uint32 argument = index - 1;
+            for (uint32 i = 0; i < program->data[node].count; i++) {
+                noh_da_append(&codegen->arguments, argument);
+                argument = codegen->starts.elems[argument] - 1;
+            }
+
+            emit_operand(codegen, program, first, argument);
+            emit_char(emitter, '(');
+            bool first_argument = true;
+            for (size_t i = codegen->arguments.count; i > arguments_start; i--) {
+                uint32 argument = codegen->arguments.elems[i - 1];
+                // Applying a function to () calls it without arguments.
+                if (program->kinds[first + argument] == NodeUnit) continue;
+
+                if (!first_argument) emit_literal(emitter, ", ");
+                emit_expression(codegen, program, first, argument);
+                first_argument = false;
+            }
+            emit_char(emitter, ')');
+            codegen->arguments.count = arguments_start;
+        } break;
+        default:
+            noh_assert(false && "Unknown expression node.");
+    }
+}
+
+static void emit_statement(Codegen *codegen, Program *program, NodeIndex statement) {
+    NodeData data = program->data[statement];
+    emit_literal(codegen->emitter, "    ");
+    if (program->kinds[statement] == NodeReturn) emit_cstr(codegen->emitter, data.count > 0 ? "return " : "return");
+
+    if (data.count > 0) {
+        expression_starts(codegen, program, data.first, data.count);
+        emit_expression(codegen, program, data.first, data.count - 1);
+    }
+    emit_literal(codegen->emitter, ";\n");
+}
+
+static void emit_function(Codegen *codegen, Program *program, NodeIndex implementation) {
+    Atom name = program_token(program, implementation).payload;
+    Definition definition = name < codegen->definition_count ? codegen->definitions[name] : (Definition) {0};
+    if (definition.program == NULL) {
+        codegen_error(codegen, program, implementation, "Function implementation has no definition.");
+        return;
+    }
+
+    uint32 parameter_count = program->data[implementation].count - 1;
+    if (parameter_count == 1 && node_is_unit(program, program_child(program, implementation, 0))) parameter_count = 0;
+    if (parameter_count != definition_parameters(definition.program, definition.node)) {
+        codegen_error(codegen, program, implementation,
+                      "The number of parameters does not match the function definition.");
+        return;
+    }
+
+    NodeIndex body = program_get_body(program, implementation, codegen->errors);
+
+    emit_char(codegen->emitter, '\n');
+    emit_signature(codegen, definition.program, definition.node, program, implementation);
+    emit_literal(codegen->emitter, " {\n");
+    for (uint32 i = 0; i < program->data[body].count; i++) {
+        emit_statement(codegen, program, program_child(program, body, i));
+    }
+    emit_literal(codegen->emitter, "}\n");
+}
+
+static Codegen codegen_init(Emitter *emitter, Errors *errors) {
+    Codegen codegen = {
+        .emitter = emitter,
+        .errors = errors,
+        .definitions = calloc(atoms_count(), sizeof(Definition)),
+        .definition_count = atoms_count(),
+    };
+    noh_assert(codegen.definitions != NULL && "Could not allocate enough memory");
+    return codegen;
+}
+
+// Frees the scratch space of a code generator, but not the definitions which can be shared.
+static void codegen_free_scratch(Codegen *codegen) {
+    noh_da_free(&codegen->starts);
+    noh_da_free(&codegen->stack);
+    noh_da_free(&codegen->arguments);
+}
+
+static void codegen_free(Codegen *codegen) {
+    free(codegen->definitions);
+    codegen_free_scratch(codegen);
+}
+
+// Emits the prelude, and the directives and prototypes of all programs, and fills the definitions.
+static void emit_declarations(Codegen *codegen, Programs programs) {
+    emit_cstr(codegen->emitter, prelude);
+
+    for (size_t p = 0; p < programs.count; p++) {
+        Program *program = programs.elems[p];
+        for (uint32 i = 0; i < program->data[program->root].count; i++) {
+            NodeIndex item = program_child(program, program->root, i);
+            Noh_String_View name;
+
+            if (program->kinds[item] == NodePreProc && !preproc_includes_source(program, item, &name)) {
+                emit_preproc(codegen, program, item);
+            } else if (program->kinds[item] == NodeFunctionDefinition && program->data[item].count > 0) {
+                Atom atom = program_token(program, item).payload;
+                if (codegen->definitions[atom].program != NULL) {
+                    codegen_error(codegen, program, item, "Function is already defined.");
+                    continue;
+                }
+                codegen->definitions[atom] = (Definition) { .program = program, .node = item };
+
+                emit_signature(codegen, program, item, NULL, 0);
+                emit_literal(codegen->emitter, ";\n");
+            }
+        }
+    }
+}
+
+// A function implementation, with an estimate of how much work it is to generate and compile.
+typedef struct {
+    Program *program;
+    NodeIndex node;
+    uint32 weight;
+} Implementation;
+
+typedef struct {
+    Implementation *elems;
+    size_t count;
+    size_t capacity;
+} Implementations;
+
+// Collects the function implementations of all programs in source order, and returns their total weight. The weight
+// of a function is the number of tokens up to the next top-level item, which also works for lazy bodies.
+static uint64 collect_implementations(Programs programs, Implementations *implementations) {
+    uint64 total_weight = 0;
+    for (size_t p = 0; p < programs.count; p++) {
+        Program *program = programs.elems[p];
+        uint32 item_count = program->data[program->root].count;
+        for (uint32 i = 0; i < item_count; i++) {
+            NodeIndex item = program_child(program, program->root, i);
+            if (program->kinds[item] != NodeFunctionImplementation) continue;
+
+            uint32 end = i + 1 < item_count
+                ? program->data[program_child(program, program->root, i + 1)].token
+                : program->tokens.count;
+            Implementation implementation = {
+                .program = program,
+                .node = item,
+                .weight = end - program->data[item].token,
+            };
+            noh_da_append(implementations, implementation);
+            total_weight += implementation.weight;
+        }
+    }
+
+    return total_weight;
+}
+
+// Parses the lazy bodies of the implementations in order. This is done before generating any code, since parsing them
+// changes the program and functions are generated on several threads.
+static void parse_lazy_bodies(Implementations implementations, Errors *errors) {
+    for (size_t i = 0; i < implementations.count; i++) {
+        program_get_body(implementations.elems[i].program, implementations.elems[i].node, errors);
+    }
+}
+
+// Finds where the chunk with the specified index ends, when the implementations are divided into chunks of about the
+// same weight. Every chunk gets the next functions in source order, until it has its share of the total weight.
+static size_t chunk_end(Implementations implementations, uint64 total_weight, size_t start, uint64 *done_weight,
+                        size_t chunk, size_t chunk_count) {
+    if (chunk == chunk_count - 1) return implementations.count;
+
+    uint64 chunk_weight = total_weight * (chunk + 1) / chunk_count;
+    size_t end = start;
+    while (end < implementations.count && *done_weight < chunk_weight) {
+        *done_weight += implementations.elems[end++].weight;
+    }
+    return end;
+}
+
+// Functions are only generated in parallel if every thread gets at least this many tokens.
+#define CODEGEN_CHUNK_MIN_WEIGHT (1 << 14)
+
+// A range of function implementations that is generated on its own thread, with its own emitter, errors and scratch
+// space. The definitions are shared, they are only read.
+typedef struct {
+    Codegen codegen;
+    Implementation *implementations;
+    size_t count;
+    Emitter buffer; // Holds the code if the chunk does not have an emitter of its own.
+    Errors errors;
+    pthread_t thread;
+    bool started;
+} CodegenChunk;
+
+static void *codegen_chunk(void *arg) {
+    CodegenChunk *chunk = arg;
+    for (size_t i = 0; i < chunk->count; i++) {
+        emit_function(&chunk->codegen, chunk->implementations[i].program, chunk->implementations[i].node);
+    }
+    return NULL;
+}
+
+// Generates chunks of functions, all but the first on separate threads. The chunks are finished in order, and their
+// errors are appended to the errors of the code generator in order, so the result is the same as on a single thread.
+// Chunks without an emitter emit into their buffer, which is appended to the emitter of the code generator once the
+// chunk is finished. The first chunk emits straight into it.
+static void codegen_chunks(Codegen *codegen, CodegenChunk *chunks, size_t chunk_count) {
+    for (size_t i = 1; i < chunk_count; i++) {
+        chunks[i].started = pthread_create(&chunks[i].thread, NULL, codegen_chunk, &chunks[i]) == 0;
+    }
+    codegen_chunk(&chunks[0]);
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        // If the thread of a chunk could not be started, it is generated here instead.
+        CodegenChunk *chunk = &chunks[i];
+        if (i > 0 && chunk->started) pthread_join(chunk->thread, NULL);
+        else if (i > 0) codegen_chunk(chunk);
+
+        if (chunk->codegen.emitter == &chunk->buffer) emitter_append(codegen->emitter, &chunk->buffer);
+        if (chunk->errors.count > 0) {
+            noh_da_append_multiple(codegen->errors, chunk->errors.elems, chunk->errors.count);
+        }
+
+        codegen_free_scratch(&chunk->codegen);
+        emitter_free(&chunk->buffer);
+        noh_da_free(&chunk->errors);
+    }
+}
+
+// Creates a chunk of functions with a code generator that shares the definitions of the code generator. If emitter is
+// NULL the chunk emits into its buffer.
+static void codegen_chunk_init(Codegen *codegen, CodegenChunk *chunk, Emitter *emitter, Implementation *first,
+                               size_t count) {
+    chunk->implementations = first;
+    chunk->count = count;
+    emitter_init(&chunk->buffer, -1);
+    chunk->codegen = (Codegen) {
+        .emitter = emitter == NULL ? &chunk->buffer : emitter,
+        .errors = &chunk->errors,
+        .definitions = codegen->definitions,
+        .definition_count = codegen->definition_count,
+    };
+}
+
+void codegen_unit(Programs programs, Emitter *emitter, Errors *errors, CodegenOptions options) {
+    Codegen codegen = codegen_init(emitter, errors);
+    emit_declarations(&codegen, programs);
+
+    Implementations implementations = {0};
+    uint64 total_weight = collect_implementations(programs, &implementations);
+    parse_lazy_bodies(implementations, errors);
+
+    size_t chunk_count = options.threads;
+    if (chunk_count > total_weight / CODEGEN_CHUNK_MIN_WEIGHT) chunk_count = total_weight / CODEGEN_CHUNK_MIN_WEIGHT;
+    if (chunk_count > 1) {
+        CodegenChunk *chunks = calloc(chunk_count, sizeof(*chunks));
+        noh_assert(chunks != NULL && "Could not allocate enough memory");
+
+        size_t start = 0;
+        uint64 done_weight = 0;
+        for (size_t i = 0; i < chunk_count; i++) {
+            size_t end = chunk_end(implementations, total_weight, start, &done_weight, i, chunk_count);
+            // The first chunk emits straight into the emitter, it is done first anyway.
+            codegen_chunk_init(&codegen, &chunks[i], i == 0 ? emitter : NULL, implementations.elems + start,
+                               end - start);
+            start = end;
+        }
+        codegen_chunks(&codegen, chunks, chunk_count);
+        free(chunks);
+    } else {
+        for (size_t i = 0; i < implementations.count; i++) {
+            emit_function(&codegen, implementations.elems[i].program, implementations.elems[i].node);
+        }
+    }
+
+    noh_da_free(&implementations);
+    codegen_free(&codegen);
+}
+
+size_t codegen_part_count(Programs programs, size_t max_parts) {
+    Implementations implementations = {0};
+    uint64 total_weight = collect_implementations(programs, &implementations);
+
+    size_t part_count = max_parts;
+    if (part_count > implementations.count) part_count = implementations.count;
+    if (part_count > total_weight / CODEGEN_PART_MIN_WEIGHT) part_count = total_weight / CODEGEN_PART_MIN_WEIGHT;
+
+    noh_da_free(&implementations);
+    return part_count > 0 ? part_count : 1;
+}
+
+void codegen_split(Programs programs, Emitter *header, const char *header_name, Emitter *parts, size_t part_count,
+                   Errors *errors, CodegenOptions options) {
+    Codegen codegen = codegen_init(header, errors);
+    emit_declarations(&codegen, programs);
+
+    Implementations implementations = {0};
+    uint64 total_weight = collect_implementations(programs, &implementations);
+    parse_lazy_bodies(implementations, errors);
+
+    // Every part is a chunk with its own emitter.
+    CodegenChunk *chunks = calloc(part_count, sizeof(*chunks));
+    noh_assert(chunks != NULL && "Could not allocate enough memory");
+    size_t start = 0;
+    uint64 done_weight = 0;
+    for (size_t i = 0; i < part_count; i++) {
+        emit_literal(&parts[i], "#include \"");
+        emit_cstr(&parts[i], header_name);
+        emit_literal(&parts[i], "\"\n");
+
+        size_t end = chunk_end(implementations, total_weight, start, &done_weight, i, part_count);
+        codegen_chunk_init(&codegen, &chunks[i], &parts[i], implementations.elems + start, end - start);
+        start = end;
+    }
+
+    // The parts are generated in groups of at most the number of threads.
+    size_t group_size = options.threads > 0 ? options.threads : 1;
+    for (size_t i = 0; i < part_count; i += group_size) {
+        codegen_chunks(&codegen, chunks + i, i + group_size < part_count ? group_size : part_count - i);
+    }
+
+    free(chunks);
+    noh_da_free(&implementations);
+    codegen_free(&codegen);
+}
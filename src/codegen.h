@@ -0,0 +1,37 @@
+#ifndef _CODEGEN_H
+#define _CODEGEN_H
+
+#include "common.h"
+#include "parser.h"
+#include "include.h"
+#include "emit.h"
+
+// Options for generating code.
+typedef struct {
+    size_t threads; // The number of threads that function bodies are generated on.
+} CodegenOptions;
+
+// Generates C code for the programs of a compilation unit, in the order from resolve_includes. All preprocessor
+// directives and function prototypes come first, in source order, so every function is declared before any function
+// body uses it. Includes of source files are left out, since those programs are part of the unit. Lazy bodies are
+// parsed before any code is generated, their errors and the errors of generating code are appended to errors.
+// Function bodies are generated on several threads, and put together in source order. The result does not depend on
+// the number of threads.
+void codegen_unit(Programs programs, Emitter *emitter, Errors *errors, CodegenOptions options);
+
+// The least number of tokens in every part of a split compilation unit. Smaller parts are not worth starting another
+// C compiler for.
+#define CODEGEN_PART_MIN_WEIGHT (1 << 14)
+
+// Determines how many parts a compilation unit is worth splitting into for codegen_split: at most max_parts, at most
+// one per function, and few enough that every part has CODEGEN_PART_MIN_WEIGHT tokens. Returns 1 for small units.
+size_t codegen_part_count(Programs programs, size_t max_parts);
+
+// Generates the C code of a compilation unit like codegen_unit, split into a header with the directives and prototypes
+// and a number of parts that include the header by its name. The functions are divided over the parts in source
+// order, so that every part has about the same number of tokens to compile. The parts can be compiled at the same
+// time and linked together. Parts are generated at the same time, on at most the specified number of threads.
+void codegen_split(Programs programs, Emitter *header, const char *header_name, Emitter *parts, size_t part_count,
+                   Errors *errors, CodegenOptions options);
+
+#endif // _CODEGEN_H
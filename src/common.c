@@ -1,19 +1,153 @@
 #include "common.h"
 
+static SourceFiles source_files = {0};
+
+// Finds the id of a source file by its filename. Returns false if it is not in the table.
+static bool source_file_find(const char *filename, uint32 *file_id) {
+    for (size_t i = 0; i < source_files.count; i++) {
+        if (strcmp(source_files.elems[i].filename, filename) == 0) {
+            *file_id = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Maps a file into memory and adds it to the source file table.
+bool source_file_open(char *filename, uint32 *file_id) {
+    if (source_file_find(filename, file_id)) return true;
+
+    SourceFile file = {0};
+    if (!noh_mapped_file_open(&file.mapped, filename)) return false;
+    file.filename = strdup(filename);
+    file.content = noh_sv_from_mapped_file(&file.mapped);
+
+    noh_da_append(&source_files, file);
+    *file_id = source_files.count - 1;
+    return true;
+}
+
+// Maps a source file that was opened through the source file table again.
+bool source_file_reload(uint32 file_id) {
+    SourceFile *file = source_file_get(file_id);
+    noh_mapped_file_close(&file->mapped);
+    noh_string_free(&file->edited);
+    noh_da_reset(&file->line_starts);
+    file->content = (Noh_String_View) {0};
+
+    if (!noh_mapped_file_open(&file->mapped, file->filename)) return false;
+    file->content = noh_sv_from_mapped_file(&file->mapped);
+    return true;
+}
+
+// Adds a source file with the provided content to the source file table, and returns its id.
+uint32 source_file_add(char *filename, Noh_String_View content) {
+    uint32 file_id;
+    if (source_file_find(filename, &file_id)) {
+        SourceFile *file = &source_files.elems[file_id];
+        noh_mapped_file_close(&file->mapped);
+        noh_string_free(&file->edited);
+        file->content = content;
+        noh_da_reset(&file->line_starts);
+        return file_id;
+    }
+
+    SourceFile file = { .filename = strdup(filename), .content = content };
+    noh_da_append(&source_files, file);
+    return source_files.count - 1;
+}
+
+// Gets the source file with the specified id from the source file table.
+SourceFile *source_file_get(uint32 file_id) {
+    noh_assert(file_id < source_files.count && "Unknown source file.");
+    return &source_files.elems[file_id];
+}
+
+// Replaces the bytes from start up to end in the content of a source file with the replacement.
+void source_file_edit(uint32 file_id, uint32 start, uint32 end, Noh_String_View replacement) {
+    SourceFile *file = source_file_get(file_id);
+    noh_assert(start <= end && end <= file->content.count && "Edit is outside of the file.");
+
+    // Copy the content on the first edit, the original content may be mapped or owned by someone else.
+    if (file->content.elems != file->edited.elems) {
+        noh_string_reset(&file->edited);
+        if (file->content.count > 0) noh_da_append_multiple(&file->edited, file->content.elems, file->content.count);
+        noh_mapped_file_close(&file->mapped);
+    }
+
+    // Grow the content if needed, then move everything after the edited range into place.
+    size_t tail = file->edited.count - end;
+    size_t new_count = file->edited.count - (end - start) + replacement.count;
+    if (new_count > file->edited.capacity) {
+        while (new_count > file->edited.capacity) file->edited.capacity = file->edited.capacity * 2 + NOH_DA_INIT_CAP;
+        file->edited.elems = noh_realloc_check(file->edited.elems, file->edited.capacity);
+    }
+    // Nothing is copied for empty ranges, the content and the replacement may then not have any memory.
+    if (tail > 0) memmove(file->edited.elems + start + replacement.count, file->edited.elems + end, tail);
+    if (replacement.count > 0) memcpy(file->edited.elems + start, replacement.elems, replacement.count);
+    file->edited.count = new_count;
+
+    file->content = noh_sv_from_string(&file->edited);
+}
+
+// Frees all source files.
+void source_files_free(void) {
+    for (size_t i = 0; i < source_files.count; i++) {
+        SourceFile *file = &source_files.elems[i];
+        free(file->filename);
+        noh_mapped_file_close(&file->mapped);
+        noh_string_free(&file->edited);
+        noh_da_free(&file->line_starts);
+    }
+    noh_da_free(&source_files);
+}
+
+// Fills the line starts of a file that was not lexed, in the same way as the lexer does.
+static void source_file_index_lines(SourceFile *file) {
+    noh_da_append(&file->line_starts, 0);
+    for (size_t i = 0; i < file->content.count; i++) {
+        char c = file->content.elems[i];
+        if (c == '\n' || (c == '\r' && (i + 1 >= file->content.count || file->content.elems[i + 1] != '\n'))) {
+            noh_da_append(&file->line_starts, i + 1);
+        }
+    }
+}
+
+// Determines the row and column of a location, both starting at 1.
+void location_get_position(Location loc, size_t *row, size_t *col) {
+    SourceFile *file = source_file_get(loc.file_id);
+    if (file->line_starts.count == 0) source_file_index_lines(file);
+
+    // Find the last line that starts at or before the location.
+    size_t low = 0;
+    size_t high = file->line_starts.count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (file->line_starts.elems[mid] <= loc.offset) low = mid;
+        else high = mid;
+    }
+
+    *row = low + 1;
+    *col = loc.offset - file->line_starts.elems[low] + 1;
+}
+
 // Formats a location as filename:row:col: and writes it to a Noh_String.
 void format_location(Noh_Arena *arena, Noh_String *string, Location loc) {
+    size_t row, col;
+    location_get_position(loc, &row, &col);
+
     noh_arena_save(arena);
-    char *cstr = noh_arena_sprintf(arena, Nsv_Fmt ":%zu:%zu", Nsv_Arg(loc.filename), loc.row, loc.col);
+    char *cstr = noh_arena_sprintf(arena, "%s:%zu:%zu", source_file_get(loc.file_id)->filename, row, col);
     noh_string_append_cstr(string, cstr);
-    noh_arena_reset(arena);
+    noh_arena_rewind(arena);
 }
 
 // Moves right on a location by the specified distance.
 Location location_move_right(Location loc, int distance) {
     Location result = {
-        .filename = loc.filename,
-        .row = loc.row,
-        .col = loc.col + distance
+        .file_id = loc.file_id,
+        .offset = loc.offset + distance
     };
     return result;
 }
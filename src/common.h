@@ -3,12 +3,61 @@
 
 #include "noh.h"
 
+// The offsets in a source file at which lines start.
 typedef struct {
-    Noh_String filename;
-    size_t row;
-    size_t col;
+    uint32 *elems;
+    size_t count;
+    size_t capacity;
+} LineStarts;
+
+// A source file that is being compiled. Locations refer to a source file by its id, which is the index in the
+// source file table. Every file is only in the table once.
+typedef struct {
+    char *filename;
+    Noh_Mapped_File mapped; // Only set if the file was opened through the source file table.
+    Noh_String edited; // Owns the content once the file is edited.
+    Noh_String_View content;
+    LineStarts line_starts; // Filled by the lexer, used to find rows and columns.
+} SourceFile;
+
+typedef struct {
+    SourceFile *elems;
+    size_t count;
+    size_t capacity;
+} SourceFiles;
+
+// Maps a file into memory and adds it to the source file table. If the file is already in the table, the existing
+// id is returned and the file is not mapped again.
+bool source_file_open(char *filename, uint32 *file_id);
+
+// Adds a source file with the provided content to the source file table, and returns its id. If a file with the same
+// filename is already in the table, its content is replaced.
+// The content is not copied, so it should outlive everything that refers to the source file.
+uint32 source_file_add(char *filename, Noh_String_View content);
+
+// Gets the source file with the specified id from the source file table.
+// Adding files to the table can move the files, so the result should not be kept after that.
+SourceFile *source_file_get(uint32 file_id);
+
+// Replaces the bytes from start up to end in the content of a source file with the replacement. The first edit
+// copies the content, later edits change that copy in place. The line starts are not updated.
+void source_file_edit(uint32 file_id, uint32 start, uint32 end, Noh_String_View replacement);
+
+// Maps a source file that was opened through the source file table again, to pick up changes on disk. Any edits and
+// line starts are dropped, and anything that refers to the old content becomes invalid.
+bool source_file_reload(uint32 file_id);
+
+// Frees all source files, and unmaps any files that were opened through the source file table.
+void source_files_free(void);
+
+typedef struct {
+    uint32 file_id;
+    uint32 offset; // The offset in bytes from the start of the file.
 } Location;
 
+// Determines the row and column of a location, both starting at 1.
+void location_get_position(Location loc, size_t *row, size_t *col);
+
 // Formats a location as filename:row:col: and writes it to a Noh_String.
 void format_location(Noh_Arena *arena, Noh_String *string, Location loc) ;
 
@@ -17,7 +66,10 @@ Location location_move_right(Location loc, int distance);
 
 typedef enum {
     LexerError,
+    LayoutError,
     ParserError,
+    IncludeError,
+    CodegenError,
 } ErrorType;
 
 typedef struct {
@@ -0,0 +1,100 @@
+#include <fcntl.h>
+#include <signal.h>
+
+#include "noh.h"
+#include "compile.h"
+
+// Gets the C compiler to run, from the CC environment variable or the default.
+static const char *c_compiler_name(void) {
+    const char *cc = getenv("CC");
+    return cc == NULL || *cc == '\0' ? DEFAULT_C_COMPILER : cc;
+}
+
+bool c_compiler_start(CCompiler *compiler, const char *executable) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        noh_log(NOH_ERROR, "Could not create a pipe to the C compiler: %s", strerror(errno));
+        return false;
+    }
+
+    // The compiler should not inherit the write end, otherwise its input never ends.
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    Noh_Cmd cmd = {0};
+    noh_cmd_append(&cmd, c_compiler_name(), "-x", "c", "-", "-o", executable);
+    compiler->pid = noh_cmd_run_async_stdin(cmd, fds[0]);
+    noh_cmd_free(&cmd);
+    close(fds[0]);
+
+    if (compiler->pid == NOH_INVALID_PROC) {
+        close(fds[1]);
+        return false;
+    }
+
+    // If the compiler stops reading, writing to it fails instead of ending this process.
+    signal(SIGPIPE, SIG_IGN);
+    compiler->fd = fds[1];
+    return true;
+}
+
+bool c_compiler_finish(CCompiler *compiler) {
+    close(compiler->fd);
+    compiler->fd = -1;
+    return noh_proc_wait(compiler->pid);
+}
+
+void c_compiler_abort(CCompiler *compiler, const char *executable) {
+    // The directive goes on a line of its own, wherever the generated code ended. If the compiler stopped reading
+    // already, it fails anyway.
+    const char directive[] = "\n#error \"The generated code is incomplete.\"\n";
+    if (write(compiler->fd, directive, sizeof(directive) - 1) < 0) {
+        noh_log(NOH_INFO, "The C compiler stopped reading: %s", strerror(errno));
+    }
+    c_compiler_finish(compiler);
+
+    if (unlink(executable) < 0 && errno != ENOENT) {
+        noh_log(NOH_ERROR, "Could not remove %s: %s", executable, strerror(errno));
+    }
+}
+
+bool c_compile_and_link(Noh_File_Paths sources, const char *executable, size_t jobs) {
+    bool result = true;
+    Noh_Arena arena = noh_arena_init(1 KB);
+    Noh_Cmd cmd = {0};
+    Noh_Procs procs = {0};
+    const char *cc = c_compiler_name();
+    if (jobs == 0) jobs = 1;
+
+    // The object of every source has the same name, with .o instead of .c.
+    Noh_File_Paths objects = {0};
+    for (size_t i = 0; i < sources.count; i++) {
+        Noh_String_View source = noh_sv_from_cstr(sources.elems[i]);
+        if (noh_sv_ends_with(source, noh_sv_from_cstr(".c"))) source.count -= 2;
+        noh_da_append(&objects, noh_arena_sprintf(&arena, Nsv_Fmt ".o", Nsv_Arg(source)));
+    }
+
+    for (size_t i = 0; i < sources.count; i++) {
+        noh_cmd_reset(&cmd);
+        noh_cmd_append(&cmd, cc, "-c", sources.elems[i], "-o", objects.elems[i]);
+        noh_da_append(&procs, noh_cmd_run_async(cmd));
+
+        // Wait for a whole batch before starting the next one.
+        if (procs.count == jobs || i == sources.count - 1) {
+            if (!noh_procs_wait(procs)) result = false;
+            noh_procs_reset(&procs);
+        }
+    }
+    if (!result) noh_return_defer(false);
+
+    noh_cmd_reset(&cmd);
+    noh_cmd_append(&cmd, cc, "-o", executable);
+    noh_da_append_multiple(&cmd, (const char **)objects.elems, objects.count);
+    if (!noh_cmd_run_sync(cmd)) noh_return_defer(false);
+
+defer:
+    noh_da_free(&objects);
+    noh_procs_free(&procs);
+    noh_cmd_free(&cmd);
+    noh_arena_free(&arena);
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef _COMPILE_H
+#define _COMPILE_H
+
+#include "noh.h"
+#include "../noh_bld.h"
+
+// The C compiler that is used if the CC environment variable is not set.
+#define DEFAULT_C_COMPILER "cc"
+
+// A running C compiler that reads the code it compiles from a pipe.
+typedef struct {
+    Noh_Pid pid;
+    int fd; // The write end of the pipe.
+} CCompiler;
+
+// Starts the C compiler, to compile the C code written to its fd into an executable. The compiler parses the code
+// while it is being generated, so the code is never written to a file and read back.
+bool c_compiler_start(CCompiler *compiler, const char *executable);
+
+// Closes the input of a C compiler and waits until it is done. Returns false if compiling failed.
+bool c_compiler_finish(CCompiler *compiler);
+
+// Stops a C compiler without building an executable, for generated code that is incomplete. The compiler is made to
+// fail with an #error directive, so it cleans up after itself, and an executable from an earlier build is removed.
+void c_compiler_abort(CCompiler *compiler, const char *executable);
+
+// Compiles C source files into object files next to them, running at most jobs compilers at once, and links the
+// objects into an executable. Returns false if compiling or linking failed.
+bool c_compile_and_link(Noh_File_Paths sources, const char *executable, size_t jobs);
+
+#endif // _COMPILE_H
@@ -0,0 +1,129 @@
+#include <unistd.h>
+
+#include "noh.h"
+#include "emit.h"
+
+void emitter_init(Emitter *emitter, int fd) {
+    *emitter = (Emitter) { .arena = noh_arena_init(EMIT_CHUNK_SIZE), .fd = fd };
+}
+
+// Closes the chunk that is being filled, so its text is part of the pending text.
+static void emitter_close_chunk(Emitter *emitter) {
+    if (emitter->cursor == NULL) return;
+
+    struct iovec *chunk = &emitter->chunks.elems[emitter->chunks.count - 1];
+    chunk->iov_len = emitter->cursor - (char *)chunk->iov_base;
+    emitter->pending += chunk->iov_len;
+    emitter->cursor = emitter->limit = NULL;
+}
+
+// Starts a new chunk to emit into.
+static void emitter_next_chunk(Emitter *emitter) {
+    emitter_close_chunk(emitter);
+    if (emitter->fd >= 0 && emitter->pending >= EMIT_FLUSH_SIZE) emitter_flush(emitter);
+
+    struct iovec chunk = { .iov_base = noh_arena_alloc(&emitter->arena, EMIT_CHUNK_SIZE), .iov_len = 0 };
+    noh_da_append(&emitter->chunks, chunk);
+    emitter->cursor = chunk.iov_base;
+    emitter->limit = emitter->cursor + EMIT_CHUNK_SIZE;
+}
+
+void emit(Emitter *emitter, Noh_String_View text) {
+    // Most text is a few bytes, which is copied without calling memcpy.
+    if (text.count <= 16 && text.count <= (size_t)(emitter->limit - emitter->cursor)) {
+        for (size_t i = 0; i < text.count; i++) emitter->cursor[i] = text.elems[i];
+        emitter->cursor += text.count;
+        return;
+    }
+
+    while (text.count > 0) {
+        if (emitter->cursor == emitter->limit) emitter_next_chunk(emitter);
+
+        size_t count = emitter->limit - emitter->cursor;
+        if (count > text.count) count = text.count;
+        memcpy(emitter->cursor, text.elems, count);
+        emitter->cursor += count;
+        text.elems += count;
+        text.count -= count;
+    }
+}
+
+void emit_cstr(Emitter *emitter, const char *cstr) {
+    emit(emitter, noh_sv_from_cstr(cstr));
+}
+
+void emit_char(Emitter *emitter, char c) {
+    if (emitter->cursor == emitter->limit) emitter_next_chunk(emitter);
+    *emitter->cursor++ = c;
+}
+
+bool emitter_flush(Emitter *emitter) {
+    if (emitter->fd < 0) return !emitter->failed;
+    emitter_close_chunk(emitter);
+
+    // writev takes a limited number of chunks at once, and can write less than it was given.
+    long max_chunks = sysconf(_SC_IOV_MAX);
+    if (max_chunks <= 0) max_chunks = 16;
+
+    struct iovec *chunks = emitter->chunks.elems;
+    size_t count = emitter->chunks.count;
+    while (count > 0 && !emitter->failed) {
+        ssize_t written = writev(emitter->fd, chunks, count < (size_t)max_chunks ? count : (size_t)max_chunks);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            noh_log(NOH_ERROR, "Could not write generated code: %s", strerror(errno));
+            emitter->failed = true;
+            break;
+        }
+
+        while (count > 0 && (size_t)written >= chunks->iov_len) {
+            written -= chunks->iov_len;
+            chunks++;
+            count--;
+        }
+        if (count > 0) {
+            chunks->iov_base = (char *)chunks->iov_base + written;
+            chunks->iov_len -= written;
+        }
+    }
+
+    noh_da_reset(&emitter->chunks);
+    noh_arena_reset(&emitter->arena);
+    emitter->pending = 0;
+    return !emitter->failed;
+}
+
+void emitter_append(Emitter *emitter, Emitter *other) {
+    emitter_close_chunk(other);
+    if (emitter->fd >= 0) {
+        emitter_flush(emitter);
+        other->fd = emitter->fd;
+        other->failed = emitter->failed;
+        emitter->failed = !emitter_flush(other);
+        other->fd = -1;
+        return;
+    }
+
+    for (size_t i = 0; i < other->chunks.count; i++) {
+        struct iovec chunk = other->chunks.elems[i];
+        emit(emitter, (Noh_String_View) { .elems = chunk.iov_base, .count = chunk.iov_len });
+    }
+}
+
+void emitter_take(Emitter *emitter, Noh_String *text) {
+    emitter_close_chunk(emitter);
+    for (size_t i = 0; i < emitter->chunks.count; i++) {
+        struct iovec chunk = emitter->chunks.elems[i];
+        if (chunk.iov_len > 0) noh_da_append_multiple(text, (char *)chunk.iov_base, chunk.iov_len);
+    }
+
+    noh_da_reset(&emitter->chunks);
+    noh_arena_reset(&emitter->arena);
+    emitter->pending = 0;
+}
+
+void emitter_free(Emitter *emitter) {
+    noh_da_free(&emitter->chunks);
+    noh_arena_free(&emitter->arena);
+    emitter->pending = 0;
+}
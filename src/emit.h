@@ -0,0 +1,63 @@
+#ifndef _EMIT_H
+#define _EMIT_H
+
+#include <sys/uio.h>
+
+#include "noh.h"
+
+// The size of the chunks that emitted text is copied into.
+#define EMIT_CHUNK_SIZE (64 KB)
+
+// An emitter that writes to a file flushes once this much text is pending.
+#define EMIT_FLUSH_SIZE (1 MB)
+
+// The chunks of text that are emitted but not written yet, in order.
+typedef struct {
+    struct iovec *elems;
+    size_t count;
+    size_t capacity;
+} EmitChunks;
+
+// A buffer for generated text. Text is copied into chunks in an arena, which are written with a single writev call
+// each time enough text is pending. After that the arena is reset, so the same chunks are reused for the next text.
+// Without a file descriptor, all text is kept until it is taken from the emitter.
+typedef struct {
+    Noh_Arena arena;
+    EmitChunks chunks; // The last chunk is the one that is being filled, its length is only set once it is full.
+    char *cursor; // Where the next text goes in the chunk that is being filled.
+    char *limit; // The end of the chunk that is being filled.
+    size_t pending; // The number of bytes in the full chunks.
+    int fd; // The file descriptor that is written to, or -1.
+    bool failed; // Whether a write failed, the emitted text is then dropped.
+} Emitter;
+
+// Initializes an emitter that writes to a file descriptor, or that keeps all text if fd is -1.
+void emitter_init(Emitter *emitter, int fd);
+
+// Appends text to an emitter.
+void emit(Emitter *emitter, Noh_String_View text);
+
+// Appends a null-terminated string to an emitter.
+void emit_cstr(Emitter *emitter, const char *cstr);
+
+// Appends a string literal to an emitter, without determining its length at runtime.
+#define emit_literal(emitter, literal) \
+    emit((emitter), (Noh_String_View) { .elems = (literal), .count = sizeof(literal) - 1 })
+
+// Appends a single character to an emitter.
+void emit_char(Emitter *emitter, char c);
+
+// Writes all pending text of an emitter to its file descriptor. Returns false if this or an earlier write failed.
+bool emitter_flush(Emitter *emitter);
+
+// Appends all text of an emitter that keeps its text to another emitter. If the other emitter writes to a file, its
+// pending text is written first and then the appended chunks are written directly, without copying them.
+void emitter_append(Emitter *emitter, Emitter *other);
+
+// Takes all text of an emitter that keeps its text, by appending it to a string. The emitter is empty afterwards.
+void emitter_take(Emitter *emitter, Noh_String *text);
+
+// Frees the memory used by an emitter, without writing pending text.
+void emitter_free(Emitter *emitter);
+
+#endif // _EMIT_H
@@ -0,0 +1,211 @@
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "noh.h"
+#include "intern.h"
+#include "lexer.h"
+#include "layout.h"
+#include "include.h"
+
+// An included file in the include cache, with everything that was produced from it. The entries are allocated one by
+// one, so the arena that the program refers to does not move.
+typedef struct {
+    Atom path; // The canonical path of the file.
+    struct timespec mtime; // The modification time of the file when it was parsed.
+    uint32 file_id;
+    Tokens tokens;
+    Tokens layout;
+    Errors errors;
+    Noh_Arena arena;
+    Program *program;
+} IncludeEntry;
+
+typedef struct {
+    IncludeEntry **elems;
+    size_t count;
+    size_t capacity;
+} IncludeEntries;
+
+typedef struct {
+    char **elems;
+    size_t count;
+    size_t capacity;
+} IncludeDirs;
+
+// The included files of all compilation units, keyed by path and modification time.
+static IncludeEntries include_cache = {0};
+static IncludeDirs include_dirs = {0};
+
+// The canonical paths of the files that are included in a compilation unit.
+typedef struct {
+    Atom *elems;
+    size_t count;
+    size_t capacity;
+} IncludedPaths;
+
+void include_dir_add(const char *dir) {
+    noh_da_append(&include_dirs, strdup(dir));
+}
+
+bool preproc_includes_source(Program *program, NodeIndex node, Noh_String_View *name) {
+    if (program->kinds[node] != NodePreProc || program->data[node].count == 0) return false;
+
+    Token keyword = program_token(program, node);
+    if (keyword.type != TokenKeyword || keyword.payload != KeywordPoundInclude) return false;
+
+    Token file = program_node_token(program, node, 0);
+    if (file.type != TokenStringLiteral || !noh_sv_ends_with(file.value, noh_sv_from_cstr(".cr"))) return false;
+
+    *name = file.value;
+    return true;
+}
+
+// Interns the canonical path of a file, if it exists.
+static bool canonical_path(const char *path, Atom *atom) {
+    char resolved[PATH_MAX];
+    if (realpath(path, resolved) == NULL) return false;
+
+    *atom = intern(noh_sv_from_cstr(resolved));
+    return true;
+}
+
+// Looks for an included file in a directory, and interns its canonical path if it is there.
+static bool include_find_in(Noh_String_View dir, Noh_String_View name, Atom *path) {
+    char candidate[PATH_MAX];
+    int length = snprintf(candidate, sizeof(candidate), Nsv_Fmt "/" Nsv_Fmt, Nsv_Arg(dir), Nsv_Arg(name));
+    if (length < 0 || (size_t)length >= sizeof(candidate)) return false;
+
+    return canonical_path(candidate, path);
+}
+
+// Finds an included file. A quoted include is first searched next to the including file, an include between angle
+// brackets only in the include directories.
+static bool include_find(uint32 includer_id, Token file, Atom *path) {
+    SourceFile *includer = source_file_get(includer_id);
+    // The location of a string literal is at its opening quote or angle bracket.
+    bool quoted = includer->content.elems[file.loc.offset] == '"';
+
+    if (quoted) {
+        Noh_String_View dir = noh_sv_from_cstr(".");
+        char *slash = strrchr(includer->filename, '/');
+        if (slash != NULL) dir = (Noh_String_View) { .elems = includer->filename, .count = slash - includer->filename };
+        if (include_find_in(dir, file.value, path)) return true;
+    }
+
+    for (size_t i = 0; i < include_dirs.count; i++) {
+        if (include_find_in(noh_sv_from_cstr(include_dirs.elems[i]), file.value, path)) return true;
+    }
+
+    return false;
+}
+
+// Gets an included file from the include cache. The file is lexed and parsed if it is not in the cache yet, or again
+// if it changed on disk since it was cached. Returns NULL if the file can not be read.
+static IncludeEntry *include_load(Atom path) {
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), Nsv_Fmt, Nsv_Arg(atom_string(path)));
+    struct stat info;
+    if (stat(filename, &info) != 0) return NULL;
+
+    IncludeEntry *entry = NULL;
+    for (size_t i = 0; i < include_cache.count; i++) {
+        if (include_cache.elems[i]->path == path) entry = include_cache.elems[i];
+    }
+
+    if (entry != NULL) {
+        if (entry->mtime.tv_sec == info.st_mtim.tv_sec && entry->mtime.tv_nsec == info.st_mtim.tv_nsec) return entry;
+
+        tokens_free(&entry->tokens);
+        tokens_free(&entry->layout);
+        noh_da_free(&entry->errors);
+        noh_arena_free(&entry->arena);
+        if (!source_file_reload(entry->file_id)) return NULL;
+    } else {
+        uint32 file_id;
+        if (!source_file_open(filename, &file_id)) return NULL;
+
+        entry = calloc(1, sizeof(IncludeEntry));
+        noh_assert(entry != NULL && "Could not allocate enough memory");
+        entry->path = path;
+        entry->file_id = file_id;
+        noh_da_append(&include_cache, entry);
+    }
+
+    entry->mtime = info.st_mtim;
+    entry->tokens = (Tokens) {0};
+    entry->layout = (Tokens) {0};
+    entry->errors = (Errors) {0};
+    lex_file(entry->file_id, &entry->tokens, &entry->errors, (LexOptions) {0});
+    layout_tokens(entry->tokens, &entry->layout, &entry->errors);
+    entry->arena = noh_arena_init(10 KB);
+    entry->program = parse_file(&entry->arena, entry->layout, &entry->errors, (ParseOptions) {0});
+    return entry;
+}
+
+static void include_error(Token token, const char *message, Errors *errors) {
+    Error error = { .message = noh_sv_from_cstr(message), .type = IncludeError, .loc = token.loc };
+    noh_da_append(errors, error);
+}
+
+static bool included_paths_contain(IncludedPaths *included, Atom path) {
+    for (size_t i = 0; i < included->count; i++) {
+        if (included->elems[i] == path) return true;
+    }
+
+    return false;
+}
+
+// Resolves the includes of a program depth first, so every program comes after the programs that it includes.
+static void resolve_includes_of(Program *program, Programs *programs, IncludedPaths *included, Errors *errors) {
+    for (uint32 i = 0; i < program->data[program->root].count; i++) {
+        NodeIndex item = program_child(program, program->root, i);
+        Noh_String_View name;
+        if (!preproc_includes_source(program, item, &name)) continue;
+
+        Token file = program_node_token(program, item, 0);
+        Atom path;
+        if (!include_find(program->tokens.file_id, file, &path)) {
+            include_error(file, "Could not find included file.", errors);
+            continue;
+        }
+        if (included_paths_contain(included, path)) continue;
+        noh_da_append(included, path);
+
+        IncludeEntry *entry = include_load(path);
+        if (entry == NULL) {
+            include_error(file, "Could not read included file.", errors);
+            continue;
+        }
+
+        noh_da_append_multiple(errors, entry->errors.elems, entry->errors.count);
+        resolve_includes_of(entry->program, programs, included, errors);
+    }
+
+    noh_da_append(programs, program);
+}
+
+void resolve_includes(Program *program, Programs *programs, Errors *errors) {
+    IncludedPaths included = {0};
+
+    // The program itself counts as included, so a file that includes it again does not.
+    Atom path;
+    if (canonical_path(source_file_get(program->tokens.file_id)->filename, &path)) noh_da_append(&included, path);
+
+    resolve_includes_of(program, programs, &included, errors);
+    noh_da_free(&included);
+}
+
+void include_cache_free(void) {
+    for (size_t i = 0; i < include_cache.count; i++) {
+        IncludeEntry *entry = include_cache.elems[i];
+        tokens_free(&entry->tokens);
+        tokens_free(&entry->layout);
+        noh_da_free(&entry->errors);
+        noh_arena_free(&entry->arena);
+        free(entry);
+    }
+    noh_da_free(&include_cache);
+
+    for (size_t i = 0; i < include_dirs.count; i++) free(include_dirs.elems[i]);
+    noh_da_free(&include_dirs);
+}
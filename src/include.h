@@ -0,0 +1,33 @@
+#ifndef _INCLUDE_H
+#define _INCLUDE_H
+
+#include "common.h"
+#include "parser.h"
+
+// The programs of a compilation unit, in the order in which they are compiled. Every included file comes before the
+// file that includes it.
+typedef struct {
+    Program **elems;
+    size_t count;
+    size_t capacity;
+} Programs;
+
+// Adds a directory in which included files are searched, after the directory of the including file.
+void include_dir_add(const char *dir);
+
+// Checks whether a preprocessor directive includes a source file, these end in .cr and are resolved by the compiler.
+// Other includes are passed on to the C compiler. If it does, its name is written to name.
+bool preproc_includes_source(Program *program, NodeIndex node, Noh_String_View *name);
+
+// Resolves the source files that a program includes, recursively, and appends the programs of the compilation unit to
+// programs, ending with the program itself. Every file is included only once per unit, which also ends include
+// cycles. Included files are lexed and parsed once and cached by path and modification time, so a file that is
+// included by several units is only parsed again if it changed on disk. The errors of included files are appended
+// to errors, together with the errors of resolving the includes.
+// The included programs are owned by the cache, and stay valid until the file changes or the cache is freed.
+void resolve_includes(Program *program, Programs *programs, Errors *errors);
+
+// Frees the include cache and the include directories, which invalidates all included programs.
+void include_cache_free(void);
+
+#endif // _INCLUDE_H
@@ -0,0 +1,114 @@
+#include "noh.h"
+#include "intern.h"
+
+typedef struct {
+    Noh_String_View *elems; // The string of every atom, indexed by atom.
+    uint32 *hashes; // The hash of every atom, indexed by atom, so the slots can grow without rehashing strings.
+    size_t count;
+    size_t capacity;
+
+    Atom *slots; // Open addressing table of atoms, ATOM_NONE means an empty slot.
+    size_t slot_count; // Always a power of 2.
+
+    Noh_Arena arena; // Holds the data of the interned strings.
+    bool initialized;
+} Atoms;
+
+static Atoms atoms = {0};
+
+uint32 intern_hash(Noh_String_View sv) {
+    // FNV-1a.
+    uint32 hash = 2166136261u;
+    for (size_t i = 0; i < sv.count; i++) {
+        hash ^= (uint8)sv.elems[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void atoms_init(void) {
+    atoms.arena = noh_arena_init(64 KB);
+    atoms.slot_count = 1024;
+    atoms.slots = calloc(atoms.slot_count, sizeof(*atoms.slots));
+    noh_assert(atoms.slots != NULL && "Could not allocate enough memory");
+
+    // Atom 0 is ATOM_NONE, it is the empty string but is never found in the slots.
+    atoms.capacity = NOH_DA_INIT_CAP;
+    atoms.elems = noh_realloc_check(atoms.elems, atoms.capacity * sizeof(*atoms.elems));
+    atoms.hashes = noh_realloc_check(atoms.hashes, atoms.capacity * sizeof(*atoms.hashes));
+    atoms.elems[0] = (Noh_String_View) { .count = 0, .elems = "" };
+    atoms.hashes[0] = 0;
+    atoms.count = 1;
+
+    atoms.initialized = true;
+}
+
+// Doubles the number of slots, keeping the load factor at most one half.
+static void atoms_grow_slots(void) {
+    size_t slot_count = atoms.slot_count * 2;
+    Atom *slots = calloc(slot_count, sizeof(*slots));
+    noh_assert(slots != NULL && "Could not allocate enough memory");
+
+    for (Atom atom = 1; atom < atoms.count; atom++) {
+        size_t slot = atoms.hashes[atom] & (slot_count - 1);
+        while (slots[slot] != ATOM_NONE) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = atom;
+    }
+
+    free(atoms.slots);
+    atoms.slots = slots;
+    atoms.slot_count = slot_count;
+}
+
+Atom intern(Noh_String_View sv) {
+    return intern_with_hash(sv, intern_hash(sv));
+}
+
+Atom intern_with_hash(Noh_String_View sv, uint32 hash) {
+    if (!atoms.initialized) atoms_init();
+
+    size_t slot = hash & (atoms.slot_count - 1);
+    while (atoms.slots[slot] != ATOM_NONE) {
+        Atom atom = atoms.slots[slot];
+        if (atoms.hashes[atom] == hash && noh_sv_eq(atoms.elems[atom], sv)) return atom;
+        slot = (slot + 1) & (atoms.slot_count - 1);
+    }
+
+    // Not found, add a new atom in the empty slot.
+    if (atoms.count >= atoms.capacity) {
+        atoms.capacity *= 2;
+        atoms.elems = noh_realloc_check(atoms.elems, atoms.capacity * sizeof(*atoms.elems));
+        atoms.hashes = noh_realloc_check(atoms.hashes, atoms.capacity * sizeof(*atoms.hashes));
+    }
+
+    char *data = noh_arena_alloc(&atoms.arena, sv.count);
+    memcpy(data, sv.elems, sv.count);
+
+    Atom atom = atoms.count++;
+    atoms.elems[atom] = (Noh_String_View) { .count = sv.count, .elems = data };
+    atoms.hashes[atom] = hash;
+    atoms.slots[slot] = atom;
+
+    if (atoms.count * 2 > atoms.slot_count) atoms_grow_slots();
+    return atom;
+}
+
+Noh_String_View atom_string(Atom atom) {
+    if (!atoms.initialized) atoms_init();
+    noh_assert(atom < atoms.count && "Unknown atom.");
+    return atoms.elems[atom];
+}
+
+size_t atoms_count(void) {
+    return atoms.initialized ? atoms.count : 1;
+}
+
+void atoms_free(void) {
+    if (!atoms.initialized) return;
+
+    free(atoms.elems);
+    free(atoms.hashes);
+    free(atoms.slots);
+    noh_arena_free(&atoms.arena);
+    atoms = (Atoms){0};
+}
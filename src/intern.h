@@ -0,0 +1,31 @@
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include "noh.h"
+
+// An interned string. Equal strings are interned as the same atom, so they can be compared with a single integer
+// compare, and the atom itself can be used as a hash.
+typedef uint32 Atom;
+
+// No atom, this is never returned by intern.
+#define ATOM_NONE 0
+
+// Interns a string, and returns its atom. The string is copied into the intern pool the first time it is seen.
+Atom intern(Noh_String_View sv);
+
+// Hashes a string the way intern does. The hash does not touch the intern pool, so it can be computed on any thread.
+uint32 intern_hash(Noh_String_View sv);
+
+// Interns a string of which the hash was already computed with intern_hash.
+Atom intern_with_hash(Noh_String_View sv, uint32 hash);
+
+// Gets the string of an atom. The string lives as long as the intern pool.
+Noh_String_View atom_string(Atom atom);
+
+// Returns the number of atoms in the intern pool, all atoms are below this number.
+size_t atoms_count(void);
+
+// Frees the intern pool, which invalidates all atoms.
+void atoms_free(void);
+
+#endif // _INTERN_H
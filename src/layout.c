@@ -0,0 +1,76 @@
+#include "noh.h"
+#include "layout.h"
+
+void layout_init(Layout *layout, uint32 file_id, Errors *errors) {
+    *layout = (Layout) { .file_id = file_id, .errors = errors, .first_line = true };
+    noh_da_append(&layout->stack, 0);
+}
+
+// Lays out the indent token of a line that is not empty.
+static void layout_line(Layout *layout, Tokens *tokens) {
+    IndentStack *stack = &layout->stack;
+
+    // The virtual tokens are placed at the first token of the line.
+    uint32 width = layout->indent_width;
+    uint32 offset = layout->indent_offset + width;
+    if (!layout->first_line) tokens_append(tokens, TokenLayoutNewline, offset, 0, 0);
+    layout->first_line = false;
+
+    if (width > stack->elems[stack->count - 1]) {
+        noh_da_append(stack, width);
+        tokens_append(tokens, TokenLayoutIndent, offset, 0, 0);
+        return;
+    }
+
+    while (width < stack->elems[stack->count - 1]) {
+        stack->count--;
+        tokens_append(tokens, TokenLayoutDedent, offset, 0, 0);
+    }
+
+    // A line between the widths of two blocks starts a new block, so indents and dedents stay balanced.
+    if (width != stack->elems[stack->count - 1]) {
+        Error error = {
+            .message = noh_sv_from_cstr("Indentation does not match any enclosing block."),
+            .type = LayoutError,
+            .loc = { .file_id = layout->file_id, .offset = offset }
+        };
+        noh_da_append(layout->errors, error);
+
+        noh_da_append(stack, width);
+        tokens_append(tokens, TokenLayoutIndent, offset, 0, 0);
+    }
+}
+
+void layout_push(Layout *layout, TokenType type, uint32 offset, uint32 length, uint32 payload, Tokens *tokens) {
+    // An indent that is followed by another indent starts an empty line, which does not take part in the layout.
+    if (type == TokenIndent) {
+        layout->has_indent = true;
+        layout->indent_offset = offset;
+        layout->indent_width = length;
+        return;
+    }
+
+    if (layout->has_indent) layout_line(layout, tokens);
+    layout->has_indent = false;
+    tokens_append(tokens, type, offset, length, payload);
+}
+
+void layout_finish(Layout *layout, Tokens *tokens) {
+    // End the last line and close all blocks at the end of the file.
+    uint32 end = source_file_get(layout->file_id)->content.count;
+    if (!layout->first_line) tokens_append(tokens, TokenLayoutNewline, end, 0, 0);
+    for (size_t i = 1; i < layout->stack.count; i++) tokens_append(tokens, TokenLayoutDedent, end, 0, 0);
+
+    noh_da_free(&layout->stack);
+}
+
+void layout_tokens(Tokens tokens, Tokens *layout, Errors *errors) {
+    layout->file_id = tokens.file_id;
+
+    Layout state;
+    layout_init(&state, tokens.file_id, errors);
+    for (size_t i = 0; i < tokens.count; i++) {
+        layout_push(&state, tokens.types[i], tokens.offsets[i], tokens.lengths[i], tokens.payloads[i], layout);
+    }
+    layout_finish(&state, layout);
+}
@@ -0,0 +1,47 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+#include "common.h"
+#include "lexer.h"
+
+// The indentation widths of the blocks that are open, the first is the top level.
+typedef struct {
+    uint32 *elems;
+    size_t count;
+    size_t capacity;
+} IndentStack;
+
+// The state of the layout pass while going through the tokens of a file one at a time.
+typedef struct {
+    uint32 file_id;
+    Errors *errors;
+    IndentStack stack;
+    bool first_line;
+    // The indent token at the start of the current line. It is only laid out at the first token after it, since empty
+    // lines do not take part in the layout.
+    bool has_indent;
+    uint32 indent_offset;
+    uint32 indent_width;
+} Layout;
+
+// Applies the off-side rule to the tokens of a file, and appends the result to the layout tokens. The indent token at
+// the start of every line is replaced by virtual tokens that describe the block structure:
+// - TokenLayoutNewline between two lines that are not empty.
+// - TokenLayoutIndent when a line is indented further than the line before it, which starts a block.
+// - TokenLayoutDedent for every block that ends when a line is indented less, and at the end of the file.
+// Indents and dedents are always balanced. The tokens should be lexed without trivia in the stream.
+// Generated errors are appended to errors.
+void layout_tokens(Tokens tokens, Tokens *layout, Errors *errors);
+
+// Initializes the layout pass for a file whose tokens are pushed one at a time, like the ones from a Lexer.
+// Generated errors are appended to errors.
+void layout_init(Layout *layout, uint32 file_id, Errors *errors);
+
+// Lays out the next token of the file, and appends the result to the layout tokens. Layout tokens for a line are only
+// appended once its first token is pushed.
+void layout_push(Layout *layout, TokenType type, uint32 offset, uint32 length, uint32 payload, Tokens *tokens);
+
+// Ends the last line and closes all blocks at the end of the file, and frees the memory used by the layout pass.
+void layout_finish(Layout *layout, Tokens *tokens);
+
+#endif // _LAYOUT_H
@@ -1,244 +1,781 @@
+#include <pthread.h>
+
 #include "noh.h"
+#include "intern.h"
 #include "lexer.h"
 
-typedef struct {
-    Noh_String_View line;
-    Location start;
-    bool has_pound;
-} Line;
+#define SYMBOL_TEXT(name, text) text,
 
-typedef struct {
-    Line *elems;
-    size_t count;
-    size_t capacity;
-} Lines;
+// The text of every multichar symbol, indexed by symbol - SymbolFirstMultichar.
+static const char *multichar_symbol_texts[] = { MULTICHAR_SYMBOLS(SYMBOL_TEXT) };
 
-// The list of symbols that should be lexed as full symbols.
-// When in this list, the full symbol will be attempted to be lexed, otherwise, any individual character is
-// considered a unique symbol if it isn't alphanumeric.
-static char *multichar_symbols[] = { "::", "()", "->", "//", "/*", "*/" };
+// Multichar symbols are lexed with a DFA that is built from the symbol list once. State 0 is the start state, and
+// since no transition leads back to it, 0 also means there is no transition.
+#define SYMBOL_DFA_STATES 64
+static uint8 symbol_dfa[SYMBOL_DFA_STATES][256];
+static uint16 symbol_dfa_accepts[SYMBOL_DFA_STATES]; // The symbol that ends in a state, or 0.
 
-static bool is_whitespace(char c) {
-    return c == ' ' || c == '\t';
+// Builds the multichar symbol DFA, only does something the first time it is called.
+static void symbols_init(void) {
+    static bool initialized = false;
+    if (initialized) return;
+
+    size_t state_count = 1;
+    for (size_t i = 0; i < noh_array_len(multichar_symbol_texts); i++) {
+        const char *text = multichar_symbol_texts[i];
+        size_t state = 0;
+        for (size_t j = 0; text[j] != '\0'; j++) {
+            uint8 c = text[j];
+            if (symbol_dfa[state][c] == 0) {
+                noh_assert(state_count < SYMBOL_DFA_STATES && "Too many symbols, increase SYMBOL_DFA_STATES.");
+                symbol_dfa[state][c] = state_count++;
+            }
+            state = symbol_dfa[state][c];
+        }
+        symbol_dfa_accepts[state] = SymbolFirstMultichar + i;
+    }
+    initialized = true;
 }
 
-static bool is_numeric(char c) {
-    return c >= '0' && c <= '9';
+#define KEYWORD_TEXT(name, text) text,
+
+// The text of every keyword, indexed by keyword.
+static const char *keyword_texts[] = { KEYWORDS(KEYWORD_TEXT) PREPROC_KEYWORDS(KEYWORD_TEXT) };
+
+// The longest keyword, longer words do not need to be looked up.
+#define KEYWORD_MAX_LENGTH 8
+
+// Keywords are found with a perfect hash over the first, second and last character and the length. The slot table
+// is filled from the keyword list once, and a collision fails an assertion, after which the factors in
+// keyword_hash need to be changed.
+#define KEYWORD_SLOTS 128
+static uint8 keyword_slots[KEYWORD_SLOTS]; // The keyword + 1, or 0 for an empty slot.
+static uint8 keyword_lengths[KeywordCount];
+
+// Hashes a word of at least 2 characters into a keyword slot.
+static inline size_t keyword_hash(const char *word, size_t length) {
+    return ((uint8)word[0] + (uint8)word[1] * 5 + (uint8)word[length - 1] * 12 + length) & (KEYWORD_SLOTS - 1);
 }
 
-static bool is_alpha(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+// Fills the keyword slot table, only does something the first time it is called.
+static void keywords_init(void) {
+    static bool initialized = false;
+    if (initialized) return;
+
+    for (size_t i = 0; i < KeywordCount; i++) {
+        size_t length = strlen(keyword_texts[i]);
+        noh_assert(length >= 2 && length <= KEYWORD_MAX_LENGTH && "Keyword length not supported by the hash.");
+        size_t slot = keyword_hash(keyword_texts[i], length);
+        noh_assert(keyword_slots[slot] == 0 && "Keyword hash collision, change the factors in keyword_hash.");
+        keyword_slots[slot] = i + 1;
+        keyword_lengths[i] = length;
+    }
+    initialized = true;
 }
 
-static bool is_alphanum(char c) {
-    return is_alpha(c) || is_numeric(c);
+// Looks up whether a word is a keyword, and which one.
+static inline bool keyword_lookup(Noh_String_View word, Keyword *keyword) {
+    if (word.count < 2 || word.count > KEYWORD_MAX_LENGTH) return false;
+
+    uint8 slot = keyword_slots[keyword_hash(word.elems, word.count)];
+    if (slot == 0) return false;
+
+    // The slot only tells which keyword it could be, it still needs to be compared.
+    Keyword candidate = slot - 1;
+    if (keyword_lengths[candidate] != word.count) return false;
+    if (memcmp(keyword_texts[candidate], word.elems, word.count) != 0) return false;
+
+    *keyword = candidate;
+    return true;
 }
 
-static Token lex_number(Line *line, size_t *start_col) {
-    Noh_String_View start = line->line;
-    Noh_String_View pre = noh_sv_chop_while(&line->line, *is_numeric);
-    if (line->line.count > 0 && line->line.elems[0] == '.') {
-        noh_sv_increase_position(&line->line, 1);
-        Noh_String_View post = noh_sv_chop_while(&line->line, *is_numeric);
+// Character classes, used to classify characters with a single table lookup.
+#define CHAR_WHITESPACE (1 << 0)
+#define CHAR_NEWLINE    (1 << 1)
+#define CHAR_NUMERIC    (1 << 2)
+#define CHAR_ALPHA      (1 << 3)
+#define CHAR_ALPHANUM   (CHAR_ALPHA | CHAR_NUMERIC)
 
-        Token token = {
-            .type = TokenNumberLiteral,
-            .loc = location_move_right(line->start, *start_col),
-            .value = noh_sv_substring(start, 0, pre.count + post.count + 1)
-        };
-        *start_col += pre.count + post.count + 1;
-        return token;
+static const uint8 char_classes[256] = {
+    [' '] = CHAR_WHITESPACE,
+    ['\t'] = CHAR_WHITESPACE,
+    ['\r'] = CHAR_NEWLINE,
+    ['\n'] = CHAR_NEWLINE,
+    ['0' ... '9'] = CHAR_NUMERIC,
+    ['a' ... 'z'] = CHAR_ALPHA,
+    ['A' ... 'Z'] = CHAR_ALPHA,
+};
+
+// Checks whether a character is in any of the classes in the mask.
+#define char_is(c, mask) ((char_classes[(uint8)(c)] & (mask)) != 0)
+
+// Chops a string view while its characters are in any of the classes in the mask.
+// Does the same as noh_sv_chop_while, but without calling a predicate for every character.
+static inline Noh_String_View chop_while_class(Noh_String_View *sv, uint8 mask) {
+    const char *start = sv->elems;
+    const char *end = sv->elems + sv->count;
+    const char *pos = start;
+    while (pos < end && char_is(*pos, mask)) pos++;
+
+    Noh_String_View result = { .count = pos - start, .elems = start };
+    sv->elems = pos;
+    sv->count = end - pos;
+    return result;
+}
+
+// Copies an array of tokens that is borrowed into newly allocated memory that can hold the capacity.
+static void *tokens_own(const void *elems, size_t count, size_t capacity, size_t size) {
+    void *owned = noh_realloc_check(NULL, capacity * size);
+    if (count > 0) memcpy(owned, elems, count * size);
+    return owned;
+}
+
+// Grows the arrays of a token stream to hold at least the required number of tokens. A stream with tokens but without
+// capacity borrows its arrays, e.g. from a cache entry, so those are copied instead of reallocated.
+static void tokens_grow(Tokens *tokens, size_t required) {
+    if (required <= tokens->capacity) return;
+
+    size_t capacity = tokens->capacity == 0 ? NOH_DA_INIT_CAP : tokens->capacity;
+    while (capacity < required) capacity *= 2;
+    if (tokens->capacity == 0 && tokens->count > 0) {
+        tokens->types = tokens_own(tokens->types, tokens->count, capacity, sizeof(*tokens->types));
+        tokens->offsets = tokens_own(tokens->offsets, tokens->count, capacity, sizeof(*tokens->offsets));
+        tokens->lengths = tokens_own(tokens->lengths, tokens->count, capacity, sizeof(*tokens->lengths));
+        tokens->payloads = tokens_own(tokens->payloads, tokens->count, capacity, sizeof(*tokens->payloads));
     } else {
-        Token token = {
-            .type = TokenNumberLiteral,
-            .loc = location_move_right(line->start, *start_col),
-            .value = pre
-        };
-        *start_col += pre.count;
-        return token;
+        tokens->types = noh_realloc_check(tokens->types, capacity * sizeof(*tokens->types));
+        tokens->offsets = noh_realloc_check(tokens->offsets, capacity * sizeof(*tokens->offsets));
+        tokens->lengths = noh_realloc_check(tokens->lengths, capacity * sizeof(*tokens->lengths));
+        tokens->payloads = noh_realloc_check(tokens->payloads, capacity * sizeof(*tokens->payloads));
     }
+    tokens->capacity = capacity;
 }
 
-static Token lex_symbol(Line *line, size_t *start_col) {
-    // It can be a multichar symbol.
-    for (size_t i = 0; i < noh_array_len(multichar_symbols); i++) {
-        Noh_String_View symbol = noh_sv_from_cstr(multichar_symbols[i]);
-        if (noh_sv_starts_with(line->line, symbol)) {
-            Token token = {
-                .type = TokenSymbol,
-                .loc = location_move_right(line->start, *start_col),
-                .value = symbol
-            };
-            noh_sv_increase_position(&line->line, symbol.count);
-            *start_col += symbol.count;
-            return token;
-        }
-    }
+void tokens_append(Tokens *tokens, TokenType type, uint32 offset, uint32 length, uint32 payload) {
+    if (tokens->count >= tokens->capacity) tokens_grow(tokens, tokens->count + 1);
 
-    // If no symbol matched, return single character as symbol.
+    tokens->types[tokens->count] = type;
+    tokens->offsets[tokens->count] = offset;
+    tokens->lengths[tokens->count] = length;
+    tokens->payloads[tokens->count] = payload;
+    tokens->count++;
+}
+
+Token tokens_get(Tokens tokens, size_t index) {
+    noh_assert(index < tokens.count && "Index out of bounds.");
+
+    SourceFile *file = source_file_get(tokens.file_id);
     Token token = {
-        .type = TokenSymbol,
-        .loc = location_move_right(line->start, *start_col),
-        .value = noh_sv_substring(line->line, 0, 1)
+        .type = tokens.types[index],
+        .value = { .count = tokens.lengths[index], .elems = file->content.elems + tokens.offsets[index] },
+        .loc = { .file_id = tokens.file_id, .offset = tokens.offsets[index] },
+        .payload = tokens.payloads[index]
     };
-    noh_sv_increase_position(&line->line, 1);
-    *start_col += 1;
+
+    // The value of a string literal starts after its opening quote, but the token starts at the quote.
+    if (token.type == TokenStringLiteral) token.loc.offset -= 1;
+
     return token;
 }
 
-// Lexes a string literal, continuing until the specified end symbol.
-static void lex_literal(Tokens *tokens, Errors *errors, Line *line, size_t *start_col, char end_symbol) {
-    noh_sv_increase_position(&line->line, 1);
-    Noh_String_View start = line->line;
+void tokens_free(Tokens *tokens) {
+    if (tokens->capacity > 0) {
+        free(tokens->types);
+        free(tokens->offsets);
+        free(tokens->lengths);
+        free(tokens->payloads);
+    }
+    tokens->types = NULL;
+    tokens->offsets = NULL;
+    tokens->lengths = NULL;
+    tokens->payloads = NULL;
+    tokens->count = 0;
+    tokens->capacity = 0;
+}
+
+// Gets the location of a position in the file that is being lexed.
+static Location lexer_location(Lexer *lexer, const char *position) {
+    return (Location) { .file_id = lexer->file_id, .offset = position - lexer->base };
+}
+
+// Chops the whitespace at the start of a string view. Runs of spaces, like indentation, are skipped several
+// characters at a time, single whitespace characters are handled without calling into noh.
+static inline Noh_String_View chop_whitespace(Noh_String_View *sv) {
+    if (sv->count < 2 || sv->elems[0] != ' ' || sv->elems[1] != ' ') return chop_while_class(sv, CHAR_WHITESPACE);
+
+    Noh_String_View result = { .count = noh_sv_span_char(*sv, ' '), .elems = sv->elems };
+    noh_sv_increase_position(sv, result.count);
+
+    // Any tabs or further spaces after the run of spaces.
+    result.count += chop_while_class(sv, CHAR_WHITESPACE).count;
+    return result;
+}
+
+// Adds a token with the specified value to the tokens. The value must point into the file that is being lexed.
+static void lexer_add_token(Lexer *lexer, Tokens *tokens, TokenType type, Noh_String_View value, uint32 payload) {
+    tokens_append(tokens, type, value.elems - lexer->base, value.count, payload);
+}
+
+// Adds a whitespace or comment token, to the tokens or the trivia side table depending on the options.
+static void lexer_add_trivia(Lexer *lexer, Tokens *tokens, TokenType type, Noh_String_View value) {
+    if (lexer->options.keep_trivia) lexer_add_token(lexer, tokens, type, value, 0);
+    else if (lexer->options.trivia) lexer_add_token(lexer, lexer->options.trivia, type, value, 0);
+}
+
+// Gets the payload of an identifier or string literal, which is its atom, or only its hash if atoms are deferred.
+static inline uint32 lexer_atom(Lexer *lexer, Noh_String_View value) {
+    return lexer->defer_atoms ? intern_hash(value) : intern(value);
+}
+
+static void lex_number(Tokens *tokens, Lexer *lexer) {
+    Noh_String_View start = lexer->rest;
+    Noh_String_View pre = chop_while_class(&lexer->rest, CHAR_NUMERIC);
+    if (lexer->rest.count > 0 && lexer->rest.elems[0] == '.') {
+        noh_sv_increase_position(&lexer->rest, 1);
+        Noh_String_View post = chop_while_class(&lexer->rest, CHAR_NUMERIC);
+        lexer_add_token(lexer, tokens, TokenNumberLiteral, noh_sv_substring(start, 0, pre.count + post.count + 1), 0);
+    } else {
+        lexer_add_token(lexer, tokens, TokenNumberLiteral, pre, 0);
+    }
+}
+
+static void lex_symbol(Tokens *tokens, Lexer *lexer) {
+    // Run the DFA as far as it goes, and keep the longest symbol that was seen.
+    size_t state = 0;
     size_t length = 0;
-    bool escaped = false;
-    while ((line->line.elems[0] != end_symbol || escaped) && line->line.count > 0) {
-        noh_sv_increase_position(&line->line, 1);
+    size_t symbol_length = 0;
+    uint32 symbol = 0;
+    while (length < lexer->rest.count) {
+        state = symbol_dfa[state][(uint8)lexer->rest.elems[length]];
+        if (state == 0) break;
         length++;
-        escaped = (line->line.elems[0] == '\\');
+        if (symbol_dfa_accepts[state] != 0) {
+            symbol = symbol_dfa_accepts[state];
+            symbol_length = length;
+        }
+    }
+
+    // If no symbol matched, return single character as symbol.
+    if (symbol_length == 0) {
+        symbol = (uint8)lexer->rest.elems[0];
+        symbol_length = 1;
     }
 
+    lexer_add_token(lexer, tokens, TokenSymbol, noh_sv_substring(lexer->rest, 0, symbol_length), symbol);
+    noh_sv_increase_position(&lexer->rest, symbol_length);
+}
+
+// Lexes a string literal, continuing until the specified end symbol.
+static void lex_literal(Tokens *tokens, Errors *errors, Lexer *lexer, char end_symbol) {
+    Location loc = lexer_location(lexer, lexer->rest.elems);
+    noh_sv_increase_position(&lexer->rest, 1);
+    Noh_String_View start = lexer->rest;
+
+    // Jump from one character of interest to the next, a backslash escapes the character after it.
+    const char stops[] = { end_symbol, '\\', '\r', '\n' };
+    size_t length = 0;
+    bool terminated = false;
+    while (length < start.count) {
+        Noh_String_View remaining = { .count = start.count - length, .elems = start.elems + length };
+        length += noh_sv_find_first_of(remaining, stops, noh_array_len(stops));
+        if (length >= start.count) break;
+
+        char c = start.elems[length];
+        if (c == '\\') {
+            // An escaped line separator still ends the line.
+            bool escapes_char = length + 1 < start.count && !char_is(start.elems[length + 1], CHAR_NEWLINE);
+            length += escapes_char ? 2 : 1;
+            continue;
+        }
+
+        terminated = c == end_symbol;
+        break;
+    }
+    if (length > start.count) length = start.count;
+    noh_sv_increase_position(&lexer->rest, length);
+
     // If we are at the end of the line, show an error that the string never ended.
-    if (line->line.count == 0) {
+    if (!terminated) {
         Error error = {
             .type = LexerError,
             .message = noh_sv_from_cstr("Line ended while lexing string literal."),
-            .loc = location_move_right(line->start, *start_col)
+            .loc = loc
         };
         noh_da_append(errors, error);
     } 
 
     // Add the string token regardless.
-    Token token = {
-        .type = TokenStringLiteral,
-        .loc = location_move_right(line->start, *start_col),
-        .value = noh_sv_substring(start, 0, length)
-    };
-    noh_da_append(tokens, token);
-    noh_sv_increase_position(&line->line, 1);
-    *start_col += length + 2;
+    Noh_String_View value = { .count = length, .elems = start.elems };
+    lexer_add_token(lexer, tokens, TokenStringLiteral, value, lexer_atom(lexer, value));
+    if (terminated) noh_sv_increase_position(&lexer->rest, 1);
 }
 
 // Gets an indent token from a line. This should be done at the start of every nonempty line.
-static void lex_indent(Tokens *tokens, Errors *errors, Line *line, size_t *end_col) {
-    Token token = {
-        .type = TokenIndent,
-        .loc = line->start,
-    };
-    if (is_whitespace(line->line.elems[0])) {
-        Noh_String_View indent = noh_sv_chop_while(&line->line, *is_whitespace);
-        token.value = indent;
-        *end_col = indent.count;
+static void lex_indent(Tokens *tokens, Errors *errors, Lexer *lexer) {
+    if (lexer->rest.count > 0 && char_is(lexer->rest.elems[0], CHAR_WHITESPACE)) {
+        Noh_String_View indent = chop_whitespace(&lexer->rest);
+        lexer_add_token(lexer, tokens, TokenIndent, indent, 0);
 
         // If there is indentation, check that there are no invalid characters in the indentation.
-        int tab_pos = noh_sv_index_of(indent, noh_sv_from_cstr("\t"));
-        if (tab_pos >= 0) {
+        const char *tab = memchr(indent.elems, '\t', indent.count);
+        if (tab != NULL) {
             Error error = {
                 .type = LexerError,
                 .message = noh_sv_from_cstr("Tabs are not allowed in indentation."),
-                .loc = location_move_right(line->start, tab_pos)
+                .loc = lexer_location(lexer, tab)
             };
             noh_da_append(errors, error);
         }
     } else {
         // No whitespace at the start, insert a zero indentation token.
-        Noh_String_View empty = { .elems = line->line.elems, .count = 0 };
-        token.value = empty;
-        *end_col = 0;
-
+        Noh_String_View empty = { .elems = lexer->rest.elems, .count = 0 };
+        lexer_add_token(lexer, tokens, TokenIndent, empty, 0);
     }
-    noh_da_append(tokens, token);
 }
 
-static void lex_elem(Tokens *tokens, Errors *errors, Line *line, size_t *start_col) {
-    (void)errors;
+static void lex_elem(Tokens *tokens, Errors *errors, Lexer *lexer) {
     // Skip whitespace, and add it as a token if there is any.
-    Noh_String_View ws = noh_sv_chop_while(&line->line, *is_whitespace);
-    if (ws.count > 0) {
-        Token token = {
-            .type = TokenWhitespace,
-            .loc = location_move_right(line->start, *start_col),
-            .value = ws
-        };
-        noh_da_append(tokens, token);
-    }
-    *start_col += ws.count;
+    Noh_String_View ws = chop_whitespace(&lexer->rest);
+    if (ws.count > 0) lexer_add_trivia(lexer, tokens, TokenWhitespace, ws);
 
-    // If we only had whitespace left, just return.
-    if (line->line.count == 0) return;
+    // If we only had whitespace left on this line, just return.
+    if (lexer->rest.count == 0 || char_is(lexer->rest.elems[0], CHAR_NEWLINE)) return;
 
-    char c = line->line.elems[0];
+    char c = lexer->rest.elems[0];
     // Otherwise, check for the first character to see what we should try to lex.
-    if (is_alpha(c)) {
-        // Try to lex a keyword.
-        Noh_String_View value = noh_sv_chop_while(&line->line, *is_alphanum);
-        Token token = {
-            .type = TokenKeyword,
-            .loc = location_move_right(line->start, *start_col),
-            .value = value
-        };
-        noh_da_append(tokens, token);
-        *start_col += value.count;
-    } else if (is_numeric(c)) {
+    if (char_is(c, CHAR_ALPHA)) {
+        // Lex a keyword or identifier.
+        Noh_String_View value = chop_while_class(&lexer->rest, CHAR_ALPHANUM);
+        Keyword keyword;
+        if (keyword_lookup(value, &keyword)) lexer_add_token(lexer, tokens, TokenKeyword, value, keyword);
+        else lexer_add_token(lexer, tokens, TokenIdentifier, value, lexer_atom(lexer, value));
+    } else if (char_is(c, CHAR_NUMERIC)) {
         // Try to lex a number
-        noh_da_append(tokens, lex_number(line, start_col));
+        lex_number(tokens, lexer);
     } else if (c == '#') {
         // Try to lex a pound keyword.
-        Noh_String_View after_hash = noh_sv_substring(line->line, 1, 0);
-        Noh_String_View value = noh_sv_chop_while(&after_hash, *is_alphanum);
-        if (value.count > 0) {
-            Token token = {
-                .type = TokenKeyword,
-                .loc = location_move_right(line->start, *start_col),
-                .value = noh_sv_substring(line->line, 0, value.count + 1) // Value + preceding #
-            };
-            noh_da_append(tokens, token);
-            noh_sv_increase_position(&line->line, value.count + 1);
-            line->has_pound = true;
-            *start_col += value.count + 1;
+        Noh_String_View after_hash = noh_sv_substring(lexer->rest, 1, 0);
+        Noh_String_View value = chop_while_class(&after_hash, CHAR_ALPHANUM);
+        Noh_String_View pound_value = noh_sv_substring(lexer->rest, 0, value.count + 1); // Value + preceding #
+        Keyword keyword;
+        if (value.count > 0 && keyword_lookup(pound_value, &keyword)) {
+            lexer_add_token(lexer, tokens, TokenKeyword, pound_value, keyword);
+            noh_sv_increase_position(&lexer->rest, pound_value.count);
+            lexer->has_pound = true;
         } else {
-            // Otherwise, return the pound symbol as a symbol.
-            Token token = {
-                .type = TokenSymbol,
-                .loc = location_move_right(line->start, *start_col),
-                .value = noh_sv_from_cstr("#")
-            };
-            noh_da_append(tokens, token);
-            noh_sv_increase_position(&line->line, 1);
-            *start_col += 1;
+            // Otherwise, return the pound symbol as a symbol, anything after it is lexed separately.
+            lexer_add_token(lexer, tokens, TokenSymbol, noh_sv_substring(lexer->rest, 0, 1), '#');
+            noh_sv_increase_position(&lexer->rest, 1);
         }
+    } else if (c == '/' && lexer->rest.count > 1 && lexer->rest.elems[1] == '/') {
+        // A comment continues until the end of the line.
+        size_t length = noh_sv_find_first_of(lexer->rest, "\r\n", 2);
+        lexer_add_trivia(lexer, tokens, TokenComment, noh_sv_substring(lexer->rest, 0, length));
+        noh_sv_increase_position(&lexer->rest, length);
     } else if (c == '"') {
         // Try to lex a regular string.
-        lex_literal(tokens, errors, line, start_col, '"');
+        lex_literal(tokens, errors, lexer, '"');
     } else if (c == '\'') {
-        lex_literal(tokens, errors, line, start_col, '\'');
-    } else if (c == '<' && line->has_pound) {
-        lex_literal(tokens, errors, line, start_col, '>');
+        lex_literal(tokens, errors, lexer, '\'');
+    } else if (c == '<' && lexer->has_pound) {
+        lex_literal(tokens, errors, lexer, '>');
+    } else {
+        lex_symbol(tokens, lexer);
+    }
+}
+
+// Moves past the line separator at the current position, and to the start of the next line.
+// Supports '\r', '\n' and '\r\n', like noh_sv_chop_line.
+static void lex_newline(Lexer *lexer) {
+    if (lexer->rest.count > 1 && lexer->rest.elems[0] == '\r' && lexer->rest.elems[1] == '\n') {
+        noh_sv_increase_position(&lexer->rest, 2);
     } else {
-        noh_da_append(tokens, lex_symbol(line, start_col));
+        noh_sv_increase_position(&lexer->rest, 1);
     }
+
+    if (lexer->line_starts) noh_da_append(lexer->line_starts, lexer->rest.elems - lexer->base);
+    lexer->has_pound = false;
 }
 
-void lex_file(Noh_String_View sv, char *filename, Tokens *tokens, Errors *errors) {
-    Lines lines = {0};
-    // Note that this string should not be freed, as it will live in the locations of the tokens.
-    Noh_String fn_str = noh_string_from_cstr(filename);
+void lexer_init(Lexer *lexer, uint32 file_id, Errors *errors, LexOptions options) {
+    keywords_init();
+    symbols_init();
+
+    SourceFile *file = source_file_get(file_id);
+    Noh_String_View sv = file->content;
+
+    // Offsets in the token stream are 32 bits.
+    noh_assert(sv.count <= UINT32_MAX && "File is too large to lex.");
+
+    // The line starts are rebuilt while lexing, the first line starts at the start of the file.
+    noh_da_reset(&file->line_starts);
+    if (!options.skip_line_starts) noh_da_append(&file->line_starts, 0);
 
-    // Split up in lines.
-    size_t line_counter = 0;
-    while (sv.count > 0) {
-        Line line = {0};
-        line.line = noh_sv_chop_line(&sv);
-        line.start = (Location) { fn_str, ++line_counter, 1 };
-        noh_da_append(&lines, line);
+    if (options.trivia) options.trivia->file_id = file_id;
+    *lexer = (Lexer) {
+        .rest = sv,
+        .base = sv.elems,
+        .file_id = file_id,
+        .line_starts = options.skip_line_starts ? NULL : &file->line_starts,
+        .errors = errors,
+        .options = options,
+        .has_pound = false,
+        .at_line_start = true,
+        .defer_atoms = false,
+        .buffer = { .file_id = file_id },
+        .buffer_start = 0
+    };
+}
+
+// Lexes the next part of the file into the tokens, which is the indentation at the start of a line, a single element
+// with any whitespace before it, or a line separator. Returns false if the end of the file is reached.
+static bool lexer_step(Lexer *lexer, Tokens *tokens) {
+    if (lexer->rest.count == 0) return false;
+
+    if (lexer->at_line_start) {
+        lex_indent(tokens, lexer->errors, lexer); // Check for indentation.
+        lexer->at_line_start = false;
+    } else if (char_is(lexer->rest.elems[0], CHAR_NEWLINE)) {
+        lex_newline(lexer);
+        lexer->at_line_start = true;
+    } else {
+        lex_elem(tokens, lexer->errors, lexer);
+    }
+
+    return true;
+}
+
+// Ensures that the buffer of a lexer holds at least the specified number of unread tokens, unless the end of the file
+// is reached first. Returns whether there are enough tokens.
+static bool lexer_fill(Lexer *lexer, size_t count) {
+    Tokens *buffer = &lexer->buffer;
+    if (buffer->count - lexer->buffer_start >= count) return true;
+
+    // Move the unread tokens to the front, so the buffer only grows as far as the lookahead needs.
+    size_t unread = buffer->count - lexer->buffer_start;
+    if (lexer->buffer_start > 0) {
+        memmove(buffer->types, buffer->types + lexer->buffer_start, unread * sizeof(*buffer->types));
+        memmove(buffer->offsets, buffer->offsets + lexer->buffer_start, unread * sizeof(*buffer->offsets));
+        memmove(buffer->lengths, buffer->lengths + lexer->buffer_start, unread * sizeof(*buffer->lengths));
+        memmove(buffer->payloads, buffer->payloads + lexer->buffer_start, unread * sizeof(*buffer->payloads));
+        buffer->count = unread;
+        lexer->buffer_start = 0;
+    }
+
+    while (buffer->count < count) {
+        if (!lexer_step(lexer, buffer)) return false;
     }
 
-    // Gather tokens from lines.
-    size_t end_col;
-    for (size_t i = 0; i < lines.count; i++) {
-        Line line = lines.elems[i];
-        lex_indent(tokens, errors, &line, &end_col); // Check for indentation.
-        while (line.line.count > 0) lex_elem(tokens, errors, &line, &end_col);
+    return true;
+}
+
+bool lexer_next(Lexer *lexer, Token *token) {
+    if (!lexer_fill(lexer, 1)) return false;
+
+    *token = tokens_get(lexer->buffer, lexer->buffer_start);
+    lexer->buffer_start++;
+    return true;
+}
+
+bool lexer_peek(Lexer *lexer, size_t distance, Token *token) {
+    if (!lexer_fill(lexer, distance + 1)) return false;
+
+    *token = tokens_get(lexer->buffer, lexer->buffer_start + distance);
+    return true;
+}
+
+void lexer_free(Lexer *lexer) {
+    tokens_free(&lexer->buffer);
+    lexer->buffer_start = 0;
+}
+
+// Finds the index of the first token at or after the offset, tokens are ordered by offset.
+static size_t tokens_find_offset(Tokens *tokens, uint32 offset) {
+    size_t low = 0;
+    size_t high = tokens->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (tokens->offsets[mid] < offset) low = mid + 1;
+        else high = mid;
     }
+    return low;
 }
 
+// Replaces the tokens from index start up to end with the new tokens, and moves the offsets of the tokens after them
+// by the shift.
+static void tokens_splice(Tokens *tokens, size_t start, size_t end, Tokens *new_tokens, int64 shift) {
+    size_t tail = tokens->count - end;
+    size_t new_count = start + new_tokens->count + tail;
+    tokens_grow(tokens, new_count);
+
+    // Nothing is moved if there are no tokens after the replaced ones, the arrays may then not have any memory.
+    size_t new_end = start + new_tokens->count;
+    if (tail > 0) {
+        memmove(tokens->types + new_end, tokens->types + end, tail * sizeof(*tokens->types));
+        memmove(tokens->offsets + new_end, tokens->offsets + end, tail * sizeof(*tokens->offsets));
+        memmove(tokens->lengths + new_end, tokens->lengths + end, tail * sizeof(*tokens->lengths));
+        memmove(tokens->payloads + new_end, tokens->payloads + end, tail * sizeof(*tokens->payloads));
+    }
+
+    if (new_tokens->count > 0) {
+        memcpy(tokens->types + start, new_tokens->types, new_tokens->count * sizeof(*tokens->types));
+        memcpy(tokens->offsets + start, new_tokens->offsets, new_tokens->count * sizeof(*tokens->offsets));
+        memcpy(tokens->lengths + start, new_tokens->lengths, new_tokens->count * sizeof(*tokens->lengths));
+        memcpy(tokens->payloads + start, new_tokens->payloads, new_tokens->count * sizeof(*tokens->payloads));
+    }
+
+    for (size_t i = new_end; i < new_count; i++) tokens->offsets[i] += shift;
+    tokens->count = new_count;
+}
+
+// Lexes the rest of the file of a lexer line by line, straight into the tokens without going through the buffer of the
+// lexer.
+static void lex_lines(Lexer *lexer, Tokens *tokens) {
+    while (lexer->rest.count > 0) {
+        lex_indent(tokens, lexer->errors, lexer); // Check for indentation.
+        while (lexer->rest.count > 0 && !char_is(lexer->rest.elems[0], CHAR_NEWLINE)) {
+            lex_elem(tokens, lexer->errors, lexer);
+        }
+        if (lexer->rest.count > 0) lex_newline(lexer);
+    }
+}
+
+// A file is only cut into chunks for parallel lexing if every chunk gets at least this many bytes, smaller chunks are
+// not worth starting a thread for.
+#define LEX_CHUNK_MIN_SIZE (1 << 20)
+
+// A chunk of whole lines of a file, which is lexed on its own thread into its own arrays.
+typedef struct {
+    Lexer lexer;
+    Tokens tokens;
+    Tokens trivia;
+    Errors errors;
+    LineStarts line_starts;
+    pthread_t thread;
+    bool started;
+} LexChunk;
+
+static void *lex_chunk(void *arg) {
+    LexChunk *chunk = arg;
+    lex_lines(&chunk->lexer, &chunk->tokens);
+    return NULL;
+}
+
+// Lexes the rest of the file of a lexer in chunks of whole lines, of which all but the first are lexed on separate
+// threads. No token continues past the end of a line, so the chunks lex the same as they would as part of the whole
+// file, and their results only need to be concatenated in order. Atoms are deferred on the threads and interned in
+// token order afterwards, so they are numbered the same as when lexing on a single thread.
+static void lex_chunks(Lexer *lexer, Tokens *tokens, size_t chunk_count) {
+    LexChunk *chunks = calloc(chunk_count, sizeof(*chunks));
+    noh_assert(chunks != NULL && "Could not allocate enough memory");
+
+    // Cut the file after the first '\n' from every even share of it, which always ends a line, also after a '\r'.
+    // A chunk is empty if a single line covers its whole share.
+    const char *end = lexer->rest.elems + lexer->rest.count;
+    const char *chunk_start = lexer->rest.elems;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const char *chunk_end = end;
+        if (i + 1 < chunk_count) {
+            const char *target = lexer->rest.elems + lexer->rest.count / chunk_count * (i + 1);
+            if (target < chunk_start) target = chunk_start;
+            const char *newline = memchr(target, '\n', end - target);
+            if (newline != NULL) chunk_end = newline + 1;
+        }
+
+        LexChunk *chunk = &chunks[i];
+        chunk->tokens.file_id = lexer->file_id;
+        chunk->trivia.file_id = lexer->file_id;
+        chunk->lexer = *lexer;
+        chunk->lexer.rest = (Noh_String_View) { .count = chunk_end - chunk_start, .elems = chunk_start };
+        chunk->lexer.line_starts = &chunk->line_starts;
+        chunk->lexer.errors = &chunk->errors;
+        chunk->lexer.defer_atoms = true;
+        if (lexer->options.trivia) chunk->lexer.options.trivia = &chunk->trivia;
+        chunk_start = chunk_end;
+    }
+
+    for (size_t i = 1; i < chunk_count; i++) {
+        chunks[i].started = pthread_create(&chunks[i].thread, NULL, lex_chunk, &chunks[i]) == 0;
+    }
+
+    // The first chunk is lexed on the calling thread straight into the results, with the atoms interned right away.
+    Lexer first = *lexer;
+    first.rest = chunks[0].lexer.rest;
+    lex_lines(&first, tokens);
+
+    for (size_t i = 1; i < chunk_count; i++) {
+        // If the thread of a chunk could not be started, it is lexed here instead.
+        LexChunk *chunk = &chunks[i];
+        if (chunk->started) pthread_join(chunk->thread, NULL);
+        else lex_chunk(chunk);
+
+        Tokens *chunk_tokens = &chunk->tokens;
+        for (size_t j = 0; j < chunk_tokens->count; j++) {
+            uint8 type = chunk_tokens->types[j];
+            if (type != TokenIdentifier && type != TokenStringLiteral) continue;
+
+            Noh_String_View value = {
+                .count = chunk_tokens->lengths[j],
+                .elems = lexer->base + chunk_tokens->offsets[j]
+            };
+            chunk_tokens->payloads[j] = intern_with_hash(value, chunk_tokens->payloads[j]);
+        }
+
+        tokens_splice(tokens, tokens->count, tokens->count, chunk_tokens, 0);
+        if (lexer->options.trivia) {
+            Tokens *trivia = lexer->options.trivia;
+            tokens_splice(trivia, trivia->count, trivia->count, &chunk->trivia, 0);
+        }
+        if (chunk->errors.count > 0) noh_da_append_multiple(lexer->errors, chunk->errors.elems, chunk->errors.count);
+        if (lexer->line_starts && chunk->line_starts.count > 0) {
+            noh_da_append_multiple(lexer->line_starts, chunk->line_starts.elems, chunk->line_starts.count);
+        }
+
+        tokens_free(&chunk->tokens);
+        tokens_free(&chunk->trivia);
+        noh_da_free(&chunk->errors);
+        noh_da_free(&chunk->line_starts);
+    }
+
+    noh_sv_increase_position(&lexer->rest, lexer->rest.count);
+    free(chunks);
+}
+
+void lex_file(uint32 file_id, Tokens *tokens, Errors *errors, LexOptions options) {
+    Lexer lexer;
+    lexer_init(&lexer, file_id, errors, options);
+    tokens->file_id = file_id;
+
+    size_t chunk_count = options.threads;
+    if (chunk_count > lexer.rest.count / LEX_CHUNK_MIN_SIZE) chunk_count = lexer.rest.count / LEX_CHUNK_MIN_SIZE;
+    if (chunk_count > 1) lex_chunks(&lexer, tokens, chunk_count);
+    else lex_lines(&lexer, tokens);
+}
+
+
+void relex_edit(Tokens *tokens, Errors *errors, LexOptions options, SourceEdit edit) {
+    keywords_init();
+    symbols_init();
+
+    SourceFile *file = source_file_get(tokens->file_id);
+    noh_assert(edit.start <= edit.end && edit.end <= file->content.count && "Edit is outside of the file.");
+    noh_assert(file->line_starts.count > 0 && "The file should be lexed before it is edited.");
+    size_t old_count = file->content.count;
+
+    // The lines that are relexed start at the line that contains the start of the edit. Start a line earlier after a
+    // carriage return, since the edit could turn it into a carriage return and newline.
+    LineStarts *line_starts = &file->line_starts;
+    size_t first_line = 0;
+    while (first_line + 1 < line_starts->count && line_starts->elems[first_line + 1] <= edit.start) first_line++;
+    if (first_line > 0 && line_starts->elems[first_line] > 0
+            && file->content.elems[line_starts->elems[first_line] - 1] == '\r') {
+        first_line--;
+    }
+    uint32 relex_start = line_starts->elems[first_line];
+
+    // The relexed lines continue at least until the end of the line that contains the end of the edit.
+    size_t last_line = first_line;
+    while (last_line + 1 < line_starts->count && line_starts->elems[last_line + 1] <= edit.end) last_line++;
+    size_t old_min_end = last_line + 1 < line_starts->count ? line_starts->elems[last_line + 1] : old_count;
+
+    int64 shift = (int64)edit.replacement.count - (int64)(edit.end - edit.start);
+    source_file_edit(tokens->file_id, edit.start, edit.end, edit.replacement);
+    file = source_file_get(tokens->file_id);
+    noh_assert(file->content.count <= UINT32_MAX && "File is too large to lex.");
+
+    // Lex whole lines from the start, until a line starts at or after the end of the edited lines. From there on the
+    // content is the same as before the edit, so the lines after it lex the same as before.
+    Tokens new_tokens = { .file_id = tokens->file_id };
+    Tokens new_trivia = { .file_id = tokens->file_id };
+    Errors new_errors = {0};
+    LineStarts new_line_starts = {0};
+    LexOptions range_options = options;
+    if (options.trivia) range_options.trivia = &new_trivia;
+
+    Lexer lexer = {
+        .rest = noh_sv_substring(file->content, relex_start, 0),
+        .base = file->content.elems,
+        .file_id = tokens->file_id,
+        .line_starts = &new_line_starts,
+        .errors = &new_errors,
+        .options = range_options,
+    };
+    if (relex_start >= file->content.count) lexer.rest.count = 0;
+
+    size_t new_min_end = old_min_end + shift;
+    size_t relex_end = relex_start;
+    while (lexer.rest.count > 0) {
+        lex_indent(&new_tokens, &new_errors, &lexer);
+        while (lexer.rest.count > 0 && !char_is(lexer.rest.elems[0], CHAR_NEWLINE)) {
+            lex_elem(&new_tokens, &new_errors, &lexer);
+        }
+        if (lexer.rest.count > 0) lex_newline(&lexer);
+
+        relex_end = lexer.rest.elems - lexer.base;
+        if (relex_end >= new_min_end) break;
+    }
+    if (lexer.rest.count == 0) relex_end = file->content.count;
+
+    // The position in the old content where lexing stopped, everything after it only moves.
+    size_t old_relex_end = relex_end - shift;
+    bool to_end = relex_end >= file->content.count;
+
+    // Replace the tokens of the relexed lines.
+    size_t first_token = tokens_find_offset(tokens, relex_start);
+    size_t end_token = to_end ? tokens->count : tokens_find_offset(tokens, old_relex_end);
+    tokens_splice(tokens, first_token, end_token, &new_tokens, shift);
+    if (options.trivia) {
+        first_token = tokens_find_offset(options.trivia, relex_start);
+        end_token = to_end ? options.trivia->count : tokens_find_offset(options.trivia, old_relex_end);
+        tokens_splice(options.trivia, first_token, end_token, &new_trivia, shift);
+    }
+
+    // Replace the line starts after the first relexed line, the new ones include the line that lexing stopped at.
+    size_t old_end_line = first_line + 1;
+    while (old_end_line < line_starts->count && line_starts->elems[old_end_line] <= old_relex_end) old_end_line++;
+    size_t tail = line_starts->count - old_end_line;
+    size_t new_line_count = first_line + 1 + new_line_starts.count + tail;
+    LineStarts merged = {0};
+    noh_da_append_multiple(&merged, line_starts->elems, first_line + 1);
+    if (new_line_starts.count > 0) noh_da_append_multiple(&merged, new_line_starts.elems, new_line_starts.count);
+    for (size_t i = old_end_line; i < line_starts->count; i++) noh_da_append(&merged, line_starts->elems[i] + shift);
+    noh_assert(merged.count == new_line_count);
+    noh_da_free(line_starts);
+    *line_starts = merged;
+
+    // Replace the lexer errors of the relexed lines, and move any errors after them. The new errors go where the old
+    // ones were, or before the first lexer error after them, or after the last lexer error before them.
+    size_t write = 0;
+    size_t insert_at = errors->count;
+    bool insert_found = false;
+    for (size_t i = 0; i < errors->count; i++) {
+        Error error = errors->elems[i];
+        bool in_file = error.loc.file_id == tokens->file_id;
+        bool before = error.loc.offset < relex_start;
+        bool after = !to_end && error.loc.offset >= old_relex_end;
+
+        if (in_file && error.type == LexerError) {
+            if (before && !insert_found) insert_at = write + 1;
+            if (!before && !insert_found) {
+                insert_at = write;
+                insert_found = true;
+            }
+            if (!before && !after) continue;
+        }
+        if (in_file && after) error.loc.offset += shift;
+        errors->elems[write++] = error;
+    }
+    errors->count = write;
+    if (insert_at > errors->count) insert_at = errors->count;
+    for (size_t i = 0; i < new_errors.count; i++) {
+        noh_da_append(errors, new_errors.elems[i]);
+        size_t index = insert_at + i;
+        memmove(errors->elems + index + 1, errors->elems + index, (errors->count - 1 - index) * sizeof(*errors->elems));
+        errors->elems[index] = new_errors.elems[i];
+    }
+
+    tokens_free(&new_tokens);
+    tokens_free(&new_trivia);
+    noh_da_free(&new_errors);
+    noh_da_free(&new_line_starts);
+}
@@ -6,26 +6,168 @@
 typedef enum {
     TokenIndent,
     TokenWhitespace,
+    TokenIdentifier,
     TokenKeyword,
     TokenSymbol,
     TokenStringLiteral,
     TokenNumberLiteral,
+    TokenComment,
+
+    // Virtual tokens that replace the indent tokens after the layout pass, see layout.h.
+    TokenLayoutNewline,
+    TokenLayoutIndent,
+    TokenLayoutDedent,
 } TokenType;
 
+// The reserved words of the language, these are lexed as keyword tokens instead of identifiers.
+#define KEYWORDS(X)                                                                     \
+    X(KeywordAuto, "auto") X(KeywordBool, "bool") X(KeywordBreak, "break")             \
+    X(KeywordCase, "case") X(KeywordChar, "char") X(KeywordConst, "const")             \
+    X(KeywordContinue, "continue") X(KeywordDo, "do") X(KeywordElse, "else")           \
+    X(KeywordEnum, "enum") X(KeywordFalse, "false") X(KeywordFloat, "float")           \
+    X(KeywordFor, "for") X(KeywordGoto, "goto") X(KeywordIf, "if")                     \
+    X(KeywordInline, "inline") X(KeywordInt, "int") X(KeywordLong, "long")             \
+    X(KeywordRegister, "register") X(KeywordRestrict, "restrict")                      \
+    X(KeywordReturn, "return") X(KeywordShort, "short") X(KeywordSigned, "signed")     \
+    X(KeywordSizeof, "sizeof") X(KeywordStatic, "static") X(KeywordStruct, "struct")   \
+    X(KeywordSwitch, "switch") X(KeywordTrue, "true") X(KeywordTypedef, "typedef")     \
+    X(KeywordUnion, "union") X(KeywordUnsigned, "unsigned") X(KeywordVoid, "void")     \
+    X(KeywordVolatile, "volatile") X(KeywordWhile, "while")
+
+// The preprocessor keywords, these include the preceding #.
+#define PREPROC_KEYWORDS(X)                                                                   \
+    X(KeywordPoundDefine, "#define") X(KeywordPoundElif, "#elif") X(KeywordPoundElse, "#else") \
+    X(KeywordPoundEndif, "#endif") X(KeywordPoundError, "#error") X(KeywordPoundIf, "#if")    \
+    X(KeywordPoundIfdef, "#ifdef") X(KeywordPoundIfndef, "#ifndef")                          \
+    X(KeywordPoundInclude, "#include") X(KeywordPoundLine, "#line")                          \
+    X(KeywordPoundPragma, "#pragma") X(KeywordPoundUndef, "#undef")
+
+#define KEYWORD_ENUM(name, text) name,
+#define KEYWORD_COUNT(name, text) + 1
+
+typedef enum {
+    KEYWORDS(KEYWORD_ENUM)
+    PREPROC_KEYWORDS(KEYWORD_ENUM)
+    KeywordCount,
+} Keyword;
+
+// The first preprocessor keyword, all keywords from this one are preprocessor keywords.
+#define KEYWORD_FIRST_PREPROC (0 KEYWORDS(KEYWORD_COUNT))
+
+// The symbols that consist of multiple characters, these are lexed with maximal munch. Any other character that is
+// not part of another token is a symbol by itself, and has the character as its payload.
+#define MULTICHAR_SYMBOLS(X)                                                          \
+    X(SymbolColonColon, "::") X(SymbolUnit, "()") X(SymbolArrow, "->")                  \
+    X(SymbolCommentStart, "/*") X(SymbolCommentEnd, "*/")                               \
+    X(SymbolEqualEqual, "==") X(SymbolNotEqual, "!=") X(SymbolLessEqual, "<=")          \
+    X(SymbolGreaterEqual, ">=") X(SymbolAndAnd, "&&") X(SymbolOrOr, "||")
+
+#define SYMBOL_ENUM(name, text) name,
+
+// The payloads of multichar symbol tokens, these come after all single character payloads.
+typedef enum {
+    SymbolFirstMultichar = 256,
+    SymbolMulticharBefore = SymbolFirstMultichar - 1,
+    MULTICHAR_SYMBOLS(SYMBOL_ENUM)
+    SymbolCount,
+} Symbol;
+
+// A single token, as it is read from a token stream.
 typedef struct {
     Noh_String_View value;
     TokenType type;
     Location loc;
+    // The keyword of a keyword token, the symbol of a symbol token, or the atom of an identifier or string literal.
+    uint32 payload;
 } Token;
 
+// A stream of tokens lexed from a single file, stored as separate arrays per field to keep them compact.
+// The value of a token is stored as its offset and length in the file, the location of the token is derived from
+// the value when needed.
 typedef struct {
-    Token *elems;
+    uint8 *types;
+    uint32 *offsets;
+    uint32 *lengths;
+    uint32 *payloads;
     size_t count;
-    size_t capacity;
+    size_t capacity; // 0 if the arrays are borrowed, e.g. from a cache entry, they are copied when the stream grows.
+    uint32 file_id;
 } Tokens;
 
-// Lexes a file.
-// Appends the generated tokens to tokens and the generated errors to errors.
-void lex_file(Noh_String_View sv, char *filename, Tokens *tokens, Errors *errors);
+// Appends a token to a token stream, with its value at the specified offset and length in the file of the stream.
+void tokens_append(Tokens *tokens, TokenType type, uint32 offset, uint32 length, uint32 payload);
+
+// Gets the token at the specified index from a token stream.
+Token tokens_get(Tokens tokens, size_t index);
+
+// Frees the memory used by a token stream, borrowed arrays are left alone.
+void tokens_free(Tokens *tokens);
+
+// Options for lexing a file.
+typedef struct {
+    // Whether whitespace and comment tokens (trivia) are kept in the token stream. The parser does not need them.
+    bool keep_trivia;
+    // If trivia is not kept in the token stream, it is appended to this side table instead, unless it is NULL.
+    Tokens *trivia;
+    // The number of threads lex_file may use. A large file is cut into chunks of whole lines that are lexed in
+    // parallel, 0 or 1 lexes on the calling thread only.
+    size_t threads;
+    // Whether the line starts of the file are left empty while lexing, so they do not grow with the file. They are then
+    // indexed when a location in the file is first resolved.
+    bool skip_line_starts;
+} LexOptions;
+
+// The state of the lexer while going through a file in a single pass.
+typedef struct {
+    Noh_String_View rest; // The part of the file that is not lexed yet.
+    const char *base; // The start of the file, token offsets are relative to this.
+    uint32 file_id;
+    LineStarts *line_starts; // The line starts of the file, filled while lexing unless it is NULL.
+    Errors *errors;
+    LexOptions options;
+    bool has_pound;
+    bool at_line_start;
+    // Whether identifiers and string literals get the hash of their string as payload instead of their atom, so
+    // they can be lexed without touching the intern pool and interned later.
+    bool defer_atoms;
+
+    // Tokens that are lexed but not yet read with lexer_next, starting at buffer_start. This only holds as many
+    // tokens as are looked ahead at, so memory stays bounded regardless of the size of the file.
+    Tokens buffer;
+    size_t buffer_start;
+} Lexer;
+
+// Initializes a lexer to lex a file from the source file table one token at a time, and fills its line starts unless
+// the options skip them. Generated errors are appended to errors. The tokens are the same as the ones from lex_file.
+// Only the tokens that are looked ahead at are kept, parse_stream uses this to go through a file with memory bounded
+// by its largest top-level item.
+void lexer_init(Lexer *lexer, uint32 file_id, Errors *errors, LexOptions options);
+
+// Gets the next token from a lexer. Returns false if there are no more tokens.
+bool lexer_next(Lexer *lexer, Token *token);
+
+// Looks at a token ahead of a lexer without consuming it, a distance of 0 is the token that lexer_next returns next.
+// Returns false if there are not that many tokens left.
+bool lexer_peek(Lexer *lexer, size_t distance, Token *token);
+
+// Frees the memory used by a lexer.
+void lexer_free(Lexer *lexer);
+
+// Lexes a file from the source file table, and fills its line starts.
+// Appends the generated tokens to tokens and the generated errors to errors. The result is the same regardless of
+// the number of threads in the options.
+void lex_file(uint32 file_id, Tokens *tokens, Errors *errors, LexOptions options);
+
+// An edit of a source file, which replaces the bytes from start up to end with the replacement.
+typedef struct {
+    uint32 start;
+    uint32 end;
+    Noh_String_View replacement;
+} SourceEdit;
+
+// Applies an edit to the file of a token stream that was lexed with lex_file, and relexes only the lines that the
+// edit touches. The tokens and lexer errors of those lines are replaced, the tokens, errors and line starts after
+// them are moved by the change in length. The options should be the same as the ones the stream was lexed with.
+void relex_edit(Tokens *tokens, Errors *errors, LexOptions options, SourceEdit edit);
 
 #endif // _LEXER_H
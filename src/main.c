@@ -1,65 +1,351 @@
 #include <stdio.h>
+#include <fcntl.h>
 
 #include "noh.h"
 #include "common.h"
 #include "lexer.h"
+#include "layout.h"
 #include "parser.h"
+#include "include.h"
+#include "cache.h"
+#include "codegen.h"
+#include "compile.h"
 
-int main(int argc, char **argv) {
-    char *program_name = noh_shift_args(&argc, &argv);
-    (void)program_name;
-
-    if (argc < 1) {
-        noh_log(NOH_ERROR, "Please provide an input filename.");
-        return 1;
-    }
-    char *filename = noh_shift_args(&argc, &argv);
+static const char *node_kind_names[] = {
+    [NodeModule] = "Module",
+    [NodePreProc] = "PreProc",
+    [NodeFunctionDefinition] = "FunctionDefinition",
+    [NodeFunctionImplementation] = "FunctionImplementation",
+    [NodeType] = "Type",
+    [NodeParameter] = "Parameter",
+    [NodeBody] = "Body",
+    [NodeLazyBody] = "LazyBody",
+    [NodeStatement] = "Statement",
+    [NodeReturn] = "Return",
+    [NodeIdentifier] = "Identifier",
+    [NodeNumberLiteral] = "NumberLiteral",
+    [NodeStringLiteral] = "StringLiteral",
+    [NodeCharLiteral] = "CharLiteral",
+    [NodeBoolLiteral] = "BoolLiteral",
+    [NodeUnit] = "Unit",
+    [NodeUnary] = "Unary",
+    [NodeBinary] = "Binary",
+    [NodeCall] = "Call",
+};
 
-    Noh_Arena arena = noh_arena_init(10 KB);
-    Noh_String file_contents = {0};
-    if (!noh_string_read_file(&file_contents, filename)) return 1;
+// Prints a node and its children, with the tokens of nodes that refer to tokens, and the expressions of statements in
+// postfix order.
+static void print_node(Program *program, NodeIndex node, size_t depth) {
+    NodeKind kind = program->kinds[node];
+    printf("%*s%s", (int)depth * 2, "", node_kind_names[kind]);
+    if (kind != NodeModule) printf(" '" Nsv_Fmt "'", Nsv_Arg(program_token(program, node).value));
 
-    Tokens tokens = {0};
-    Errors errors = {0};
-    lex_file(noh_sv_from_string(&file_contents), filename, &tokens, &errors);
-
-    Program program;
-    parse_file(&tokens, &errors, &program);
+    switch (kind) {
+        case NodeModule:
+        case NodeFunctionDefinition:
+        case NodeFunctionImplementation:
+        case NodeBody:
+            printf("\n");
+            for (uint32 i = 0; i < program->data[node].count; i++) {
+                print_node(program, program_child(program, node, i), depth + 1);
+            }
+            break;
+        default:
+            noh_assert(false && "Expression nodes are printed with their statement.");
+        case NodeStatement:
+        case NodeReturn:
+            printf(":");
+            for (uint32 i = 0; i < program->data[node].count; i++) {
+                NodeIndex expr = program->data[node].first + i;
+                printf(" %s '" Nsv_Fmt "'", node_kind_names[program->kinds[expr]],
+                       Nsv_Arg(program_token(program, expr).value));
+                if (program->kinds[expr] == NodeCall) printf(" %u", program->data[expr].count);
+            }
+            printf("\n");
+            break;
+        case NodePreProc:
+        case NodeType:
+        case NodeParameter:
+        case NodeLazyBody:
+            printf(":");
+            for (uint32 i = 0; i < program->data[node].count; i++) {
+                printf(" '" Nsv_Fmt "'", Nsv_Arg(program_node_token(program, node, i).value));
+            }
+            printf("\n");
+            break;
+    }
+}
 
+// Prints every token with its location and type.
+static void print_tokens(Noh_Arena *arena, Tokens tokens) {
     noh_log(NOH_INFO, "Lexer result.");
     Noh_String pos = {0};
     Noh_String type = {0};
     for (size_t i = 0; i < tokens.count; i++) {
-        Token token = tokens.elems[i];
+        Token token = tokens_get(tokens, i);
 
         switch (token.type) {
             case TokenIndent: noh_string_append_cstr(&type, "Indent"); break;
             case TokenWhitespace: noh_string_append_cstr(&type, "Whitespace"); break;
+            case TokenIdentifier: noh_string_append_cstr(&type, "Identifier"); break;
             case TokenKeyword: noh_string_append_cstr(&type, "Keyword"); break;
             case TokenSymbol: noh_string_append_cstr(&type, "Symbol"); break;
             case TokenStringLiteral: noh_string_append_cstr(&type, "StringLiteral"); break;
             case TokenNumberLiteral: noh_string_append_cstr(&type, "NumberLiteral"); break;
+            case TokenComment: noh_string_append_cstr(&type, "Comment"); break;
+            case TokenLayoutNewline: noh_string_append_cstr(&type, "Newline"); break;
+            case TokenLayoutIndent: noh_string_append_cstr(&type, "BlockIndent"); break;
+            case TokenLayoutDedent: noh_string_append_cstr(&type, "BlockDedent"); break;
         }
 
-        format_location(&arena, &pos, token.loc);
+        format_location(arena, &pos, token.loc);
         printf(Nsv_Fmt ": " Nsv_Fmt " - '" Nsv_Fmt "'\n", Nsv_Arg(pos), Nsv_Arg(type), Nsv_Arg(token.value));
         noh_string_reset(&pos);
         noh_string_reset(&type);
     }
     noh_string_free(&pos);
+    noh_string_free(&type);
+}
+
+// Prints every error with its location.
+static void print_errors(Noh_Arena *arena, Errors errors) {
+    Noh_String pos = {0};
+    for (size_t i = 0; i < errors.count; i++) {
+        format_location(arena, &pos, errors.elems[i].loc);
+        printf(Nsv_Fmt ": ERROR: '" Nsv_Fmt "'\n", Nsv_Arg(pos), Nsv_Arg(errors.elems[i].message));
+        noh_string_reset(&pos);
+    }
+    noh_string_free(&pos);
+}
 
+// The state of -c while the items of a file are checked.
+typedef struct {
+    Noh_Arena *arena;
+    Errors *errors;
+    size_t error_count;
+} CheckState;
 
-    if (errors.count > 0) {
-        noh_log(NOH_ERROR, "Lexer or parser failed.");
-        Noh_String pos = {0};
-        for (size_t i = 0; i < errors.count; i++) {
-            format_location(&arena, &pos, errors.elems[i].loc);
-            printf(Nsv_Fmt ": ERROR: '" Nsv_Fmt "'\n", Nsv_Arg(pos), Nsv_Arg(errors.elems[i].message));
-            noh_string_reset(&pos);
+// Prints the errors that were found up to an item of a file that is checked with -c, and then the item. The errors are
+// removed once they are printed, so they do not pile up for a large file.
+static void check_item(Program *program, NodeIndex item, void *data) {
+    CheckState *state = data;
+    print_errors(state->arena, *state->errors);
+    state->error_count += state->errors->count;
+    noh_da_reset(state->errors);
+
+    print_node(program, item, 1);
+}
+
+// Opens a file to write generated code to, returns -1 if it can not be opened.
+static int open_output(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) noh_log(NOH_ERROR, "Could not open file %s: %s", path, strerror(errno));
+    return fd;
+}
+
+// Generates the C code of a compilation unit. The code is written to the output file if there is one, and streamed
+// into the C compiler to build the executable if there is one.
+static bool generate_code(Programs programs, const char *output, const char *executable, Errors *errors,
+                          CodegenOptions options) {
+    if (output != NULL && executable != NULL) {
+        noh_log(NOH_ERROR, "Only one of -o and -b can be used at once.");
+        return false;
+    }
+
+    int fd = -1;
+    CCompiler compiler;
+    if (executable != NULL) {
+        if (!c_compiler_start(&compiler, executable)) return false;
+        fd = compiler.fd;
+    } else {
+        fd = strcmp(output, "-") == 0 ? STDOUT_FILENO : open_output(output);
+        if (fd < 0) return false;
+    }
+
+    Emitter emitter;
+    emitter_init(&emitter, fd);
+    codegen_unit(programs, &emitter, errors, options);
+    bool result = emitter_flush(&emitter);
+    emitter_free(&emitter);
+
+    // Code with errors is incomplete, so it is not built into an executable, just like in build_parts.
+    if (executable != NULL && errors->count > 0) {
+        c_compiler_abort(&compiler, executable);
+        result = false;
+    } else if (executable != NULL) {
+        result = c_compiler_finish(&compiler) && result;
+    } else if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    return result;
+}
+
+// Generates the C code of a compilation unit split into parts, which are compiled at the same time and linked into
+// the executable. The generated files are kept next to the executable, in <executable>.units.
+static bool build_parts(Noh_Arena *arena, Programs programs, const char *executable, size_t part_count,
+                        Errors *errors, CodegenOptions options) {
+    bool result = true;
+    char *dir = noh_arena_sprintf(arena, "%s.units", executable);
+    if (!noh_mkdir_if_needed(dir)) return false;
+
+    Emitter header = {0};
+    emitter_init(&header, open_output(noh_arena_sprintf(arena, "%s/unit.h", dir)));
+    Emitter *parts = calloc(part_count, sizeof(Emitter));
+    noh_assert(parts != NULL && "Could not allocate enough memory");
+    Noh_File_Paths sources = {0};
+    for (size_t i = 0; i < part_count; i++) {
+        noh_da_append(&sources, noh_arena_sprintf(arena, "%s/part%zu.c", dir, i));
+        emitter_init(&parts[i], open_output(sources.elems[i]));
+    }
+
+    bool opened = header.fd >= 0;
+    for (size_t i = 0; i < part_count; i++) opened = opened && parts[i].fd >= 0;
+    if (!opened) noh_return_defer(false);
+
+    codegen_split(programs, &header, "unit.h", parts, part_count, errors, options);
+    result = emitter_flush(&header);
+    for (size_t i = 0; i < part_count; i++) result = emitter_flush(&parts[i]) && result;
+    if (!result || errors->count > 0) noh_return_defer(false);
+
+    // The files are closed before they are compiled, so all of their content is there.
+    close(header.fd);
+    header.fd = -1;
+    for (size_t i = 0; i < part_count; i++) {
+        close(parts[i].fd);
+        parts[i].fd = -1;
+    }
+    result = c_compile_and_link(sources, executable, part_count);
+
+defer:
+    if (header.fd >= 0) close(header.fd);
+    emitter_free(&header);
+    for (size_t i = 0; i < part_count; i++) {
+        if (parts[i].fd >= 0) close(parts[i].fd);
+        emitter_free(&parts[i]);
+    }
+    free(parts);
+    noh_da_free(&sources);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    char *program_name = noh_shift_args(&argc, &argv);
+    (void)program_name;
+
+    // Options come before the filename:
+    // -I<dir> adds a directory in which included files are searched.
+    // -c checks the syntax of the file in a single pass, and prints every top-level item and its errors as soon as it
+    // is parsed, see parse_stream. Included files are not checked.
+    // -o <file> writes the generated C code to a file, instead of printing the tokens and the syntax tree.
+    // -b <file> compiles the generated C code into an executable with the C compiler, see c_compiler_start.
+    // -j <n> splits the generated C code of -b into at most n parts that are compiled at the same time, the default is
+    // the number of cores. Small units are not split, see codegen_part_count.
+    char *output = NULL;
+    char *executable = NULL;
+    bool check = false;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cores > 0 ? cores : 1;
+    size_t parts = threads;
+    while (argc > 0 && argv[0][0] == '-') {
+        char *option = noh_shift_args(&argc, &argv);
+        if (strncmp(option, "-I", 2) == 0) {
+            include_dir_add(option + 2);
+        } else if (strcmp(option, "-c") == 0) {
+            check = true;
+        } else if (strcmp(option, "-o") == 0 && argc > 0) {
+            output = noh_shift_args(&argc, &argv);
+        } else if (strcmp(option, "-b") == 0 && argc > 0) {
+            executable = noh_shift_args(&argc, &argv);
+        } else if (strcmp(option, "-j") == 0 && argc > 0) {
+            parts = strtoul(noh_shift_args(&argc, &argv), NULL, 10);
+            if (parts == 0) parts = 1;
+        } else {
+            noh_log(NOH_ERROR, "Unknown option '%s'.", option);
+            return 1;
         }
-        noh_string_free(&pos);
+    }
+
+    if (argc < 1) {
+        noh_log(NOH_ERROR, "Please provide an input filename.");
         return 1;
     }
+    char *filename = noh_shift_args(&argc, &argv);
+
+    Noh_Arena arena = noh_arena_init(10 KB);
+    // The tokens point directly into the file contents, which stay mapped in the source file table.
+    uint32 file_id;
+    if (!source_file_open(filename, &file_id)) return 1;
+
+    if (check) {
+        Errors errors = {0};
+        CheckState state = { .arena = &arena, .errors = &errors };
+        noh_log(NOH_INFO, "Parser result.");
+        printf("Module\n");
+        parse_stream(file_id, &errors, (ParseOptions) {0}, check_item, &state);
+        print_errors(&arena, errors);
+        state.error_count += errors.count;
+
+        if (state.error_count > 0) noh_log(NOH_ERROR, "Found %zu errors.", state.error_count);
+        noh_da_free(&errors);
+        return state.error_count > 0 ? 1 : 0;
+    }
+
+    Tokens tokens = {0};
+    Tokens layout = {0};
+    Errors errors = {0};
+    Program *program = NULL;
+    // A file that did not change since it was last compiled is not lexed and parsed again.
+    if (!cache_load(file_id, &arena, &tokens, &layout, &program)) {
+        // Whitespace and comments are not needed by the parser, so they are not kept. Large files are lexed on all
+        // cores.
+        LexOptions lex_options = { .keep_trivia = false, .trivia = NULL, .threads = threads };
+        lex_file(file_id, &tokens, &errors, lex_options);
+
+        // The parser reads the block structure from the layout tokens instead of the indentation.
+        layout_tokens(tokens, &layout, &errors);
+        ParseOptions parse_options = { .threads = lex_options.threads };
+        program = parse_file(&arena, layout, &errors, parse_options);
+
+        // Errors are not cached, so a file with errors is compiled again and its errors are reported every time.
+        if (errors.count == 0) cache_store(file_id, tokens, layout, program);
+    }
+
+    // The included source files are compiled along with the file, before it.
+    Programs programs = {0};
+    resolve_includes(program, &programs, &errors);
+
+    bool generated = true;
+    if (output == NULL && executable == NULL) {
+        print_tokens(&arena, tokens);
+
+        noh_log(NOH_INFO, "Parser result.");
+        for (size_t i = 0; i < programs.count; i++) {
+            if (programs.elems[i] != program) {
+                printf("Included %s\n", source_file_get(programs.elems[i]->tokens.file_id)->filename);
+            }
+        }
+        print_node(program, program->root, 0);
+    } else if (errors.count == 0) {
+        // Function bodies are generated on all cores.
+        CodegenOptions codegen_options = { .threads = threads };
+        if (executable != NULL && output == NULL) parts = codegen_part_count(programs, parts);
+        if (executable != NULL && output == NULL && parts > 1) {
+            generated = build_parts(&arena, programs, executable, parts, &errors, codegen_options);
+        } else {
+            generated = generate_code(programs, output, executable, &errors, codegen_options);
+        }
+    }
+
+    if (errors.count > 0) {
+        noh_log(NOH_ERROR, "Compilation failed.");
+        print_errors(&arena, errors);
+        generated = false;
+    }
 
-    return 0;
+    // The included programs belong to the include cache.
+    noh_da_free(&programs);
+    include_cache_free();
+    cache_close();
+    noh_da_free(&errors);
+    return generated ? 0 : 1;
 }
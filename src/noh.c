@@ -1,5 +1,8 @@
 #define NOH_IMPLEMENTATION
 #include "noh.h"
+#define NOH_BLD_IMPLEMENTATION
+#include "../noh_bld.h"
 
 // This file only exists in order to be able to properly build libnoh.o,
 // since only building noh.h with -DNOH_IMPLEMENTATION did not yield proper library.
+// The process helpers of noh_bld.h are included as well, they are used to run the C compiler.
@@ -40,10 +40,18 @@
 #include <stdarg.h>
 #include <time.h>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define NOH_SIMD_X86
+    #include <immintrin.h>
+#endif // __x86_64__
+
 #ifdef _WIN32
    #include <direct.h>
 #else
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
 #endif // _WIN32
 
 
@@ -69,6 +77,14 @@
 #define uint unsigned int
 #endif
 
+#ifndef int32
+#define int32 int
+#endif
+
+#ifndef uint32
+#define uint32 unsigned int
+#endif
+
 #ifndef _WIN32
 #ifndef int64
 #define int64 long
@@ -175,14 +191,14 @@ do {
 // if needed.
 #define noh_da_append_multiple(da, new_elems, new_elems_count)                               \
 do {                                                                                         \
-    if ((da)->count + new_elems_count > (da)->capacity) {                                    \
+    if ((da)->count + (new_elems_count) > (da)->capacity) {                                  \
         if ((da)->capacity == 0) (da)->capacity = NOH_DA_INIT_CAP;                           \
-        while ((da)->count + new_elems_count > (da)->capacity) (da)->capacity *= 2;          \
+        while ((da)->count + (new_elems_count) > (da)->capacity) (da)->capacity *= 2;        \
         (da)->elems = noh_realloc_check((da)->elems, (da)->capacity * sizeof(*(da)->elems)); \
     }                                                                                        \
                                                                                              \
-    memcpy((da)->elems + (da)->count, new_elems, new_elems_count * sizeof(*(da)->elems));    \
-    (da)->count += new_elems_count;                                                          \
+    memcpy((da)->elems + (da)->count, (new_elems), (new_elems_count) * sizeof(*(da)->elems));\
+    (da)->count += (new_elems_count);                                                        \
 } while (0)
 
 // Removes the element at the specified location.
@@ -206,6 +222,7 @@ do {                          \
         (da)->count = 0;      \
         (da)->capacity = 0;   \
         free((da)->elems);    \
+        (da)->elems = NULL;   \
     }                         \
 } while (0)
 
@@ -363,6 +380,15 @@ Noh_String_View noh_sv_chop_line(Noh_String_View *sv);
 // Chops a string while a predicate matches.
 Noh_String_View noh_sv_chop_while(Noh_String_View *sv, bool (*do_chop)(char));
 
+// Returns the index of the first character in a string view that is one of the provided characters, or the count of
+// the string view if there is none. Scans 16 or 32 characters at a time if the cpu supports it and at most 4
+// characters are provided.
+size_t noh_sv_find_first_of(Noh_String_View sv, const char *chars, size_t chars_count);
+
+// Returns the length of the run of the specified character at the start of a string view. Scans 16 or 32 characters
+// at a time if the cpu supports it.
+size_t noh_sv_span_char(Noh_String_View sv, char c);
+
 // Trims the left part of a string view, until the provided function no longer holds on the current character.
 void noh_sv_trim_left(Noh_String_View *sv, bool (*do_trim)(char));
 
@@ -452,6 +478,24 @@ bool noh_rename(const char *path, const char *new_path);
 // Removes a file.
 bool noh_remove(const char *path);
 
+// The contents of a file that is mapped into memory. If the file could not be mapped, the contents are read into
+// memory at once instead.
+typedef struct {
+    const char *elems;
+    size_t count;
+    bool mapped; // Whether elems points to mapped memory, or to allocated memory.
+} Noh_Mapped_File;
+
+// Maps the contents of a file into memory, optimized for reading it sequentially. Falls back to reading the entire
+// file into memory if mapping is not possible, such as for pipes.
+bool noh_mapped_file_open(Noh_Mapped_File *file, const char *filename);
+
+// Unmaps or frees the contents of a mapped file.
+void noh_mapped_file_close(Noh_Mapped_File *file);
+
+// Creates a string view from a mapped file.
+Noh_String_View noh_sv_from_mapped_file(const Noh_Mapped_File *file);
+
 #endif // NOH_H_
 
 #ifdef NOH_IMPLEMENTATION
@@ -783,8 +827,8 @@ void noh_sv_increase_position(Noh_String_View *sv, size_t distance) {
         sv->count -= distance;
         sv->elems += distance;
     } else {
-        sv->count = 0;
         sv->elems += sv->count;
+        sv->count = 0;
     }
 }
 
@@ -817,9 +861,8 @@ Noh_String_View noh_sv_chop_while(Noh_String_View *sv, bool (*do_chop)(char)) {
 }
 
 Noh_String_View noh_sv_chop_line(Noh_String_View *sv) {
-    size_t i = 0;
     // Find a newline or carriage return character.
-    while (i < sv->count && sv->elems[i] != '\r' && sv->elems[i] != '\n') i++;
+    size_t i = noh_sv_find_first_of(*sv, "\r\n", 2);
 
     // The data until the line separator(s) is returned.
     Noh_String_View result = { .count = i, .elems = sv->elems };
@@ -837,6 +880,137 @@ Noh_String_View noh_sv_chop_line(Noh_String_View *sv) {
     return result;
 }
 
+// Which vector instructions can be used to scan strings.
+typedef enum {
+    NOH_SIMD_UNKNOWN,
+    NOH_SIMD_NONE,
+    NOH_SIMD_SSE2,
+    NOH_SIMD_AVX2,
+} Noh_Simd_Level;
+
+static Noh_Simd_Level noh_simd_level = NOH_SIMD_UNKNOWN;
+
+// Determines which vector instructions can be used, only checks the cpu the first time. Strings are scanned on several
+// threads at once, so the level is read and written atomically. Threads that check the cpu at the same time all find
+// the same level.
+static Noh_Simd_Level noh_get_simd_level(void) {
+    Noh_Simd_Level level = __atomic_load_n(&noh_simd_level, __ATOMIC_RELAXED);
+    if (level != NOH_SIMD_UNKNOWN) return level;
+
+#ifdef NOH_SIMD_X86
+    // SSE2 is always available on x86_64.
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? NOH_SIMD_AVX2 : NOH_SIMD_SSE2;
+#else
+    level = NOH_SIMD_NONE;
+#endif // NOH_SIMD_X86
+
+    __atomic_store_n(&noh_simd_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+static size_t noh_find_first_of_scalar(const char *s, size_t start, size_t n, const char *chars, size_t chars_count) {
+    for (size_t i = start; i < n; i++) {
+        for (size_t j = 0; j < chars_count; j++) {
+            if (s[i] == chars[j]) return i;
+        }
+    }
+    return n;
+}
+
+static size_t noh_span_char_scalar(const char *s, size_t start, size_t n, char c) {
+    size_t i = start;
+    while (i < n && s[i] == c) i++;
+    return i;
+}
+
+#ifdef NOH_SIMD_X86
+// The kernels compare against 4 characters, unused ones are filled with the first character.
+static size_t noh_find_first_of_sse2(const char *s, size_t n, const char c[4]) {
+    __m128i c0 = _mm_set1_epi8(c[0]), c1 = _mm_set1_epi8(c[1]), c2 = _mm_set1_epi8(c[2]), c3 = _mm_set1_epi8(c[3]);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, c0), _mm_cmpeq_epi8(block, c1)),
+            _mm_or_si128(_mm_cmpeq_epi8(block, c2), _mm_cmpeq_epi8(block, c3)));
+        int mask = _mm_movemask_epi8(eq);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return noh_find_first_of_scalar(s, i, n, c, 4);
+}
+
+__attribute__((target("avx2")))
+static size_t noh_find_first_of_avx2(const char *s, size_t n, const char c[4]) {
+    __m256i c0 = _mm256_set1_epi8(c[0]), c1 = _mm256_set1_epi8(c[1]);
+    __m256i c2 = _mm256_set1_epi8(c[2]), c3 = _mm256_set1_epi8(c[3]);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, c0), _mm256_cmpeq_epi8(block, c1)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, c2), _mm256_cmpeq_epi8(block, c3)));
+        uint mask = _mm256_movemask_epi8(eq);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return noh_find_first_of_scalar(s, i, n, c, 4);
+}
+
+static size_t noh_span_char_sse2(const char *s, size_t n, char c) {
+    __m128i cv = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s + i));
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(block, cv)) & 0xFFFF;
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return noh_span_char_scalar(s, i, n, c);
+}
+
+__attribute__((target("avx2")))
+static size_t noh_span_char_avx2(const char *s, size_t n, char c) {
+    __m256i cv = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint mask = ~(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, cv));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return noh_span_char_scalar(s, i, n, c);
+}
+#endif // NOH_SIMD_X86
+
+size_t noh_sv_find_first_of(Noh_String_View sv, const char *chars, size_t chars_count) {
+    noh_assert(chars_count > 0 && "Provide at least one character to find.");
+
+#ifdef NOH_SIMD_X86
+    if (chars_count <= 4) {
+        char c[4];
+        for (size_t i = 0; i < 4; i++) c[i] = i < chars_count ? chars[i] : chars[0];
+
+        switch (noh_get_simd_level()) {
+            case NOH_SIMD_AVX2: return noh_find_first_of_avx2(sv.elems, sv.count, c);
+            case NOH_SIMD_SSE2: return noh_find_first_of_sse2(sv.elems, sv.count, c);
+            default: break;
+        }
+    }
+#endif // NOH_SIMD_X86
+
+    return noh_find_first_of_scalar(sv.elems, 0, sv.count, chars, chars_count);
+}
+
+size_t noh_sv_span_char(Noh_String_View sv, char c) {
+#ifdef NOH_SIMD_X86
+    switch (noh_get_simd_level()) {
+        case NOH_SIMD_AVX2: return noh_span_char_avx2(sv.elems, sv.count, c);
+        case NOH_SIMD_SSE2: return noh_span_char_sse2(sv.elems, sv.count, c);
+        default: break;
+    }
+#endif // NOH_SIMD_X86
+
+    return noh_span_char_scalar(sv.elems, 0, sv.count, c);
+}
+
 void noh_sv_trim_left(Noh_String_View *sv, bool (*do_trim)(char)) {
     size_t i = 0;
     while (i < sv->count && (*do_trim)(sv->elems[i])) i++;
@@ -1029,4 +1203,135 @@ bool noh_remove(const char *path) {
     return true;
 }
 
+bool noh_mapped_file_open(Noh_Mapped_File *file, const char *filename) {
+    file->elems = NULL;
+    file->count = 0;
+    file->mapped = false;
+
+#ifdef _WIN32
+    bool result = true;
+    char *data = NULL;
+
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        noh_log(NOH_ERROR, "Could not open file %s: %s.", filename, strerror(errno));
+        noh_return_defer(false);
+    }
+
+    if (fseek(f, 0, SEEK_END) < 0) {
+        noh_log(NOH_ERROR, "Could not read file %s: %s.", filename, strerror(errno));
+        noh_return_defer(false);
+    }
+    long size = ftell(f);
+    if (size < 0 || fseek(f, 0, SEEK_SET) < 0) {
+        noh_log(NOH_ERROR, "Could not read file %s: %s.", filename, strerror(errno));
+        noh_return_defer(false);
+    }
+    if (size == 0) noh_return_defer(true);
+
+    data = noh_realloc_check(data, size);
+    if (fread(data, 1, size, f) != (size_t)size) {
+        noh_log(NOH_ERROR, "Could not read file %s: %s.", filename, strerror(errno));
+        free(data);
+        noh_return_defer(false);
+    }
+
+    file->elems = data;
+    file->count = size;
+
+defer:
+    if (f) fclose(f);
+    return result;
+#else
+    bool result = true;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        noh_log(NOH_ERROR, "Could not open file %s: %s.", filename, strerror(errno));
+        return false;
+    }
+
+    struct stat statbuf = {0};
+    if (fstat(fd, &statbuf) < 0) {
+        noh_log(NOH_ERROR, "Could not stat file %s: %s.", filename, strerror(errno));
+        noh_return_defer(false);
+    }
+
+    // Empty files cannot be mapped, but there is also nothing to read. Pipes and special files report a size of 0 too,
+    // so they are read until the end instead.
+    bool regular = S_ISREG(statbuf.st_mode);
+    size_t size = statbuf.st_size;
+    if (regular && size == 0) noh_return_defer(true);
+
+    if (regular) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // Failing to give advice is not a problem, the mapping works regardless.
+            madvise(data, size, MADV_SEQUENTIAL);
+            file->elems = data;
+            file->count = size;
+            file->mapped = true;
+            noh_return_defer(true);
+        }
+    }
+
+    // Mapping is not possible (e.g. for pipes or special files), read everything until the end of the file.
+    size_t capacity = size > 0 ? size : 64 * 1024;
+    char *buf = NULL;
+    buf = noh_realloc_check(buf, capacity);
+    size_t read_total = 0;
+    for (;;) {
+        if (read_total == capacity) {
+            capacity *= 2;
+            buf = noh_realloc_check(buf, capacity);
+        }
+
+        ssize_t n = read(fd, buf + read_total, capacity - read_total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            noh_log(NOH_ERROR, "Could not read file %s: %s.", filename, strerror(errno));
+            free(buf);
+            noh_return_defer(false);
+        }
+        if (n == 0) break;
+        read_total += n;
+    }
+
+    // An empty file has no contents, just like an empty mapped file.
+    if (read_total == 0) {
+        free(buf);
+        noh_return_defer(true);
+    }
+
+    file->elems = buf;
+    file->count = read_total;
+
+defer:
+    close(fd);
+    return result;
+#endif // _WIN32
+}
+
+void noh_mapped_file_close(Noh_Mapped_File *file) {
+    if (file->elems == NULL) return;
+
+#ifdef _WIN32
+    free((void*)file->elems);
+#else
+    if (file->mapped) munmap((void*)file->elems, file->count);
+    else free((void*)file->elems);
+#endif // _WIN32
+
+    file->elems = NULL;
+    file->count = 0;
+    file->mapped = false;
+}
+
+Noh_String_View noh_sv_from_mapped_file(const Noh_Mapped_File *file) {
+    Noh_String_View result = {0};
+    result.elems = file->elems;
+    result.count = file->count;
+    return result;
+}
+
 #endif // NOH_IMPLEMENTATION
@@ -1,34 +1,671 @@
+#include <pthread.h>
+
 #include "noh.h"
+#include "layout.h"
 #include "parser.h"
 
-static PreProc *parse_preproc(Noh_Arena *arena, Tokens *tokens, Errors *errors) {
-    (void)arena;
-    (void)tokens;
-    (void)errors;
+// Node indices on a stack, used for the children of the nodes that are being parsed.
+typedef struct {
+    NodeIndex *elems;
+    size_t count;
+    size_t capacity;
+} NodeStack;
+
+// The state of the parser while going through the tokens of a file. The tokens are the result of the layout pass, so
+// lines are separated by newline tokens and blocks are between indent and dedent tokens.
+typedef struct {
+    Program *program;
+    Tokens tokens;
+    size_t index; // The token that is parsed next.
+    Errors *errors;
+    ParseOptions options;
+
+    // The children of the nodes that are being parsed. When a node is finished its children are moved to the program
+    // at once, so the children of a node end up next to each other. The stack is reused for every node, so nodes are
+    // added without allocating.
+    NodeStack scratch;
+} Parser;
+
+// Grows an array in an arena to hold at least the required number of elements, and returns the array. The old array
+// stays in the arena until the arena is freed, which at most doubles the memory used by the array.
+static void *arena_grow(Noh_Arena *arena, void *elems, uint32 count, uint32 *capacity, uint32 required, size_t size) {
+    if (required <= *capacity) return elems;
+
+    uint32 new_capacity = *capacity == 0 ? 64 : *capacity;
+    while (new_capacity < required) new_capacity *= 2;
 
-    return null;
+    // Allocate whole 8 byte blocks, so every array in the arena starts aligned.
+    void *new_elems = noh_arena_alloc(arena, (new_capacity * size + 7) & ~(size_t)7);
+    if (count > 0) memcpy(new_elems, elems, count * size);
+    *capacity = new_capacity;
+    return new_elems;
 }
 
-Program *parse_file(Noh_Arena *arena, Tokens tokens, Errors *errors) {
-    Program *program = {0};
+static NodeIndex parser_add_node(Parser *parser, NodeKind kind, uint32 token, uint32 first, uint32 count) {
+    Program *program = parser->program;
+    if (program->node_count >= program->node_capacity) {
+        uint32 required = program->node_count + 1;
+        uint32 kinds_capacity = program->node_capacity;
+        program->kinds = arena_grow(program->arena, program->kinds, program->node_count, &kinds_capacity, required,
+                                    sizeof(*program->kinds));
+        program->data = arena_grow(program->arena, program->data, program->node_count, &program->node_capacity,
+                                   required, sizeof(*program->data));
+    }
 
-    while (tokens.count > 0) {
-        Token token = tokens.elems[0];
-        if (token.type == TokenKeyWord && noh_sv_starts_with(token.value, noh_sv_from_cstr("#"))) {
-            PreProc *preproc = parse_preproc(arena, tokens, errors);
-            if (preproc) {
-                noh_da_append(program, *preproc);
-            }
-        }
+    NodeIndex node = program->node_count++;
+    program->kinds[node] = kind;
+    program->data[node] = (NodeData) { .token = token, .first = first, .count = count };
+    return node;
+}
+
+// Adds a node that refers to the tokens from first up to end.
+static void parser_push_tokens_node(Parser *parser, NodeKind kind, size_t token, size_t first, size_t end) {
+    NodeIndex node = parser_add_node(parser, kind, token, first, end - first);
+    noh_da_append(&parser->scratch, node);
+}
 
+// Moves the nodes on the scratch stack from scratch_start to the children of the program, and returns where they
+// start.
+static uint32 parser_pop_children(Parser *parser, size_t scratch_start) {
+    Program *program = parser->program;
+    uint32 count = parser->scratch.count - scratch_start;
+    program->children = arena_grow(program->arena, program->children, program->child_count,
+                                   &program->child_capacity, program->child_count + count, sizeof(*program->children));
+
+    // A program for a few tokens may not have any children yet, the arrays then have no memory.
+    uint32 first = program->child_count;
+    if (count > 0) {
+        memcpy(program->children + first, parser->scratch.elems + scratch_start, count * sizeof(*program->children));
     }
+    program->child_count += count;
+    parser->scratch.count = scratch_start;
+    return first;
+}
 
+// Adds a node of which the children are the nodes on the scratch stack from scratch_start, and pushes it.
+static void parser_push_parent_node(Parser *parser, NodeKind kind, size_t token, size_t scratch_start) {
+    uint32 count = parser->scratch.count - scratch_start;
+    uint32 first = parser_pop_children(parser, scratch_start);
+    NodeIndex node = parser_add_node(parser, kind, token, first, count);
+    noh_da_append(&parser->scratch, node);
+}
+
+static void parser_error(Parser *parser, size_t token, const char *message) {
     Error error = {
-        .message = noh_sv_from_cstr("Parser is not finished."),
+        .message = noh_sv_from_cstr(message),
         .type = ParserError,
-        .loc = tokens->elems[0].loc
+        .loc = tokens_get(parser->tokens, token).loc
     };
-    noh_da_append(errors, error);
+    noh_da_append(parser->errors, error);
+}
+
+static bool token_is_symbol(Tokens tokens, size_t index, uint32 symbol) {
+    return tokens.types[index] == TokenSymbol && tokens.payloads[index] == symbol;
+}
+
+static bool token_is_layout(Tokens tokens, size_t index) {
+    TokenType type = tokens.types[index];
+    return type == TokenLayoutNewline || type == TokenLayoutIndent || type == TokenLayoutDedent;
+}
+
+// Finds the end of the line that contains the token at the index, which is the index of the first layout token after
+// it, or the number of tokens.
+static size_t line_end(Tokens tokens, size_t index) {
+    while (index < tokens.count && !token_is_layout(tokens, index)) index++;
+    return index;
+}
+
+// Skips a block that starts at the indent token at the index, including any blocks in it, and returns the index after
+// the dedent that ends it.
+static size_t skip_block(Tokens tokens, size_t index) {
+    size_t depth = 0;
+    for (; index < tokens.count; index++) {
+        if (tokens.types[index] == TokenLayoutIndent) depth++;
+        if (tokens.types[index] == TokenLayoutDedent && --depth == 0) return index + 1;
+    }
+    return index;
+}
+
+// name :: type -> type -> type
+static void parse_function_definition(Parser *parser, size_t start, size_t end) {
+    Tokens tokens = parser->tokens;
+    size_t scratch_start = parser->scratch.count;
+
+    // Every type is everything between two arrows.
+    size_t type_start = start + 2;
+    while (true) {
+        size_t type_end = type_start;
+        while (type_end < end && !token_is_symbol(tokens, type_end, SymbolArrow)) type_end++;
+
+        if (type_end == type_start) {
+            parser_error(parser, type_end < end ? type_end : end - 1, "Expected a type.");
+        } else {
+            parser_push_tokens_node(parser, NodeType, type_start, type_start, type_end);
+        }
+
+        if (type_end >= end) break;
+        type_start = type_end + 1;
+    }
+
+    parser_push_parent_node(parser, NodeFunctionDefinition, start, scratch_start);
+}
+
+// The binding powers of prefix operators and of function application, which bind tighter than any infix operator.
+#define POWER_PREFIX 16
+#define POWER_APPLICATION 18
+
+// Gets the binding powers of an infix operator. The left power is compared to the minimum power of the expression that
+// is being parsed, the right power is the minimum power of the right operand. Returns false for other tokens.
+static bool infix_power(Tokens tokens, size_t index, uint8 *left, uint8 *right) {
+    if (tokens.types[index] != TokenSymbol) return false;
+
+    switch (tokens.payloads[index]) {
+        case '=': *left = 2; *right = 1; return true; // Right associative.
+        case SymbolOrOr: *left = 3; *right = 4; return true;
+        case SymbolAndAnd: *left = 5; *right = 6; return true;
+        case SymbolEqualEqual: case SymbolNotEqual: *left = 7; *right = 8; return true;
+        case '<': case '>': case SymbolLessEqual: case SymbolGreaterEqual: *left = 9; *right = 10; return true;
+        case '+': case '-': *left = 11; *right = 12; return true;
+        case '*': case '/': case '%': *left = 13; *right = 14; return true;
+        default: return false;
+    }
+}
+
+static bool token_is_prefix(Tokens tokens, size_t index) {
+    if (tokens.types[index] != TokenSymbol) return false;
+    uint32 symbol = tokens.payloads[index];
+    return symbol == '-' || symbol == '!' || symbol == '~' || symbol == '*' || symbol == '&';
+}
+
+// Checks whether a token starts an operand, which makes it an argument when it follows a function.
+static bool token_starts_operand(Tokens tokens, size_t index) {
+    switch (tokens.types[index]) {
+        case TokenIdentifier:
+        case TokenNumberLiteral:
+        case TokenStringLiteral:
+            return true;
+        case TokenKeyword:
+            return tokens.payloads[index] == KeywordTrue || tokens.payloads[index] == KeywordFalse;
+        case TokenSymbol:
+            return tokens.payloads[index] == '(' || tokens.payloads[index] == SymbolUnit;
+        default:
+            return false;
+    }
+}
+
+static bool parse_expression(Parser *parser, size_t end, uint8 min_power);
+
+// Parses a literal, a name, () or an expression in parentheses. Returns false after adding an error.
+static bool parse_operand(Parser *parser, size_t end) {
+    Tokens tokens = parser->tokens;
+    size_t index = parser->index;
+    if (index >= end || !token_starts_operand(tokens, index)) {
+        parser_error(parser, index < end ? index : end - 1, "Expected an expression.");
+        return false;
+    }
+
+    parser->index++;
+    switch (tokens.types[index]) {
+        case TokenIdentifier: parser_add_node(parser, NodeIdentifier, index, 0, 0); return true;
+        case TokenNumberLiteral: parser_add_node(parser, NodeNumberLiteral, index, 0, 0); return true;
+        case TokenKeyword: parser_add_node(parser, NodeBoolLiteral, index, 0, 0); return true;
+        case TokenStringLiteral: {
+            // The lexer lexes both quotes as literals, the quote before the value tells them apart.
+            const char *content = source_file_get(tokens.file_id)->content.elems;
+            NodeKind kind = content[tokens.offsets[index] - 1] == '\'' ? NodeCharLiteral : NodeStringLiteral;
+            parser_add_node(parser, kind, index, 0, 0);
+            return true;
+        }
+        default: break;
+    }
+
+    if (tokens.payloads[index] == SymbolUnit) {
+        parser_add_node(parser, NodeUnit, index, 0, 0);
+        return true;
+    }
+
+    // An expression in parentheses only groups, it does not add a node.
+    if (!parse_expression(parser, end, 0)) return false;
+    if (parser->index >= end || !token_is_symbol(tokens, parser->index, ')')) {
+        parser_error(parser, parser->index < end ? parser->index : end - 1, "Expected ')'.");
+        return false;
+    }
+    parser->index++;
+    return true;
+}
+
+// Parses an operand, and applies it as a function to any operands that follow it.
+static bool parse_application(Parser *parser, size_t end) {
+    size_t function = parser->index;
+    if (!parse_operand(parser, end)) return false;
+
+    uint32 argument_count = 0;
+    while (parser->index < end && token_starts_operand(parser->tokens, parser->index)) {
+        if (!parse_operand(parser, end)) return false;
+        argument_count++;
+    }
+
+    if (argument_count > 0) parser_add_node(parser, NodeCall, function, 0, argument_count);
+    return true;
+}
+
+// Parses an expression with precedence climbing, where the operators are written in postfix order to the nodes of the
+// program as they are parsed. Only operators that bind at least as tight as the minimum power are parsed, the rest is
+// left to the callers. Returns false after adding an error.
+static bool parse_expression(Parser *parser, size_t end, uint8 min_power) {
+    Tokens tokens = parser->tokens;
+
+    if (parser->index < end && token_is_prefix(tokens, parser->index)) {
+        size_t operator = parser->index++;
+        if (!parse_expression(parser, end, POWER_PREFIX)) return false;
+        parser_add_node(parser, NodeUnary, operator, 0, 0);
+    } else {
+        if (!parse_application(parser, end)) return false;
+    }
+
+    uint8 left, right;
+    while (parser->index < end && infix_power(tokens, parser->index, &left, &right) && left >= min_power) {
+        size_t operator = parser->index++;
+        if (!parse_expression(parser, end, right)) return false;
+        parser_add_node(parser, NodeBinary, operator, 0, 0);
+    }
+
+    return true;
+}
+
+// A statement on a single line of a function body, the tokens are the line without its indent token.
+// If the expression of the statement has an error, the statement is left out.
+static void parse_statement(Parser *parser, size_t start, size_t end) {
+    Tokens tokens = parser->tokens;
+    NodeKind kind = NodeStatement;
+    parser->index = start;
+    if (tokens.types[start] == TokenKeyword && tokens.payloads[start] == KeywordReturn) {
+        kind = NodeReturn;
+        parser->index++;
+    }
+
+    NodeIndex first = parser->program->node_count;
+    bool valid = parser->index >= end || parse_expression(parser, end, 0);
+    if (valid && parser->index < end) {
+        parser_error(parser, parser->index, "Unexpected token after the end of the expression.");
+        valid = false;
+    }
+
+    if (valid) {
+        NodeIndex node = parser_add_node(parser, kind, start, first, parser->program->node_count - first);
+        noh_da_append(&parser->scratch, node);
+    } else {
+        // Drop the nodes of the partial expression.
+        parser->program->node_count = first;
+    }
+    parser->index = end;
+}
+
+// Parses the body of a function implementation from the tokens from start up to end, and pushes its statements. The
+// body is the rest of the implementation line and the block after it.
+static void parse_body(Parser *parser, size_t start, size_t end) {
+    Tokens tokens = parser->tokens;
+    parser->index = start;
+
+    // The body can start on the same line.
+    if (parser->index < end && !token_is_layout(tokens, parser->index)) {
+        parse_statement(parser, parser->index, line_end(tokens, parser->index));
+    }
+
+    // Skip the newline and indent before the block.
+    parser->index += 2;
+    while (parser->index < end) {
+        TokenType type = tokens.types[parser->index];
+        if (type == TokenLayoutNewline || type == TokenLayoutDedent) {
+            parser->index++;
+        } else if (type == TokenLayoutIndent) {
+            parser_error(parser, parser->index, "Blocks in function bodies are not supported.");
+            parser->index = skip_block(tokens, parser->index);
+        } else {
+            parse_statement(parser, parser->index, line_end(tokens, parser->index));
+        }
+    }
+    parser->index = end;
+}
+
+// name params =
+//     body
+static void parse_function_implementation(Parser *parser, size_t start, size_t end) {
+    Tokens tokens = parser->tokens;
+    size_t scratch_start = parser->scratch.count;
+
+    size_t index = start + 1;
+    while (index < end && !token_is_symbol(tokens, index, '=')) {
+        if (tokens.types[index] == TokenIdentifier || token_is_symbol(tokens, index, SymbolUnit)) {
+            parser_push_tokens_node(parser, NodeParameter, index, index, index + 1);
+        } else {
+            parser_error(parser, index, "Expected a parameter name or ().");
+        }
+        index++;
+    }
+
+    // The main token of the body is the '=', or the name if it is missing.
+    size_t body_token = index;
+    size_t body_start = index + 1;
+    if (index >= end) {
+        parser_error(parser, end - 1, "Expected '=' after the parameters.");
+        body_token = start;
+        body_start = end;
+    }
+
+    // The body continues in the block after the implementation line.
+    size_t body_end = end;
+    bool has_block = end + 1 < tokens.count && tokens.types[end] == TokenLayoutNewline
+        && tokens.types[end + 1] == TokenLayoutIndent;
+    if (has_block) body_end = skip_block(tokens, end + 1);
+
+    if (parser->options.lazy_bodies) {
+        parser_push_tokens_node(parser, NodeLazyBody, body_token, body_start, body_end);
+    } else {
+        size_t body_scratch_start = parser->scratch.count;
+        parse_body(parser, body_start, body_end);
+        parser_push_parent_node(parser, NodeBody, body_token, body_scratch_start);
+    }
+    parser->index = body_end;
+
+    parser_push_parent_node(parser, NodeFunctionImplementation, start, scratch_start);
+}
+
+// Parses the line that starts at the current token, and any lines that belong to it.
+static void parse_item(Parser *parser) {
+    Tokens tokens = parser->tokens;
+    size_t start = parser->index;
+    if (tokens.types[start] == TokenLayoutNewline || tokens.types[start] == TokenLayoutDedent) {
+        parser->index++;
+        return;
+    }
+    if (tokens.types[start] == TokenLayoutIndent) {
+        parser_error(parser, start, "Unexpected indentation, only function bodies are indented.");
+        parser->index = skip_block(tokens, start);
+        return;
+    }
+
+    size_t end = line_end(tokens, start);
+    parser->index = end;
+
+    if (tokens.types[start] == TokenKeyword && tokens.payloads[start] >= KEYWORD_FIRST_PREPROC) {
+        parser_push_tokens_node(parser, NodePreProc, start, start + 1, end);
+    } else if (tokens.types[start] == TokenIdentifier && start + 1 < end
+            && token_is_symbol(tokens, start + 1, SymbolColonColon)) {
+        parse_function_definition(parser, start, end);
+    } else if (tokens.types[start] == TokenIdentifier) {
+        parse_function_implementation(parser, start, end);
+    } else {
+        parser_error(parser, start,
+                     "Expected a preprocessor directive, function definition or function implementation.");
+    }
+}
+
+NodeIndex program_child(Program *program, NodeIndex node, uint32 index) {
+    noh_assert(node < program->node_count && "Unknown node.");
+    NodeData data = program->data[node];
+    noh_assert(index < data.count && "Child index out of bounds.");
+    return program->children[data.first + index];
+}
+
+Token program_token(Program *program, NodeIndex node) {
+    noh_assert(node < program->node_count && "Unknown node.");
+    return tokens_get(program->tokens, program->data[node].token);
+}
+
+Token program_node_token(Program *program, NodeIndex node, uint32 index) {
+    noh_assert(node < program->node_count && "Unknown node.");
+    NodeData data = program->data[node];
+    noh_assert(index < data.count && "Token index out of bounds.");
+    return tokens_get(program->tokens, data.first + index);
+}
+
+NodeIndex program_get_body(Program *program, NodeIndex function, Errors *errors) {
+    noh_assert(program->kinds[function] == NodeFunctionImplementation && "Only function implementations have a body.");
+    NodeIndex body = program_child(program, function, program->data[function].count - 1);
+    if (program->kinds[body] == NodeBody) return body;
+
+    // Parse the statements into the program, and turn the lazy body into a body with the statements as children.
+    NodeData data = program->data[body];
+    Parser parser = { .program = program, .tokens = program->tokens, .errors = errors };
+    parse_body(&parser, data.first, data.first + data.count);
+
+    uint32 count = parser.scratch.count;
+    program->kinds[body] = NodeBody;
+    program->data[body] = (NodeData) { .token = data.token, .first = parser_pop_children(&parser, 0), .count = count };
+
+    noh_da_free(&parser.scratch);
+    return body;
+}
+
+// Allocates an empty program in the arena, with room for the expected number of nodes.
+static Program *program_init(Noh_Arena *arena, Tokens tokens, uint32 expected) {
+    Program *program = noh_arena_alloc(arena, sizeof(Program));
+    *program = (Program) { .tokens = tokens, .arena = arena };
+
+    uint32 kinds_capacity = 0;
+    program->kinds = arena_grow(arena, NULL, 0, &kinds_capacity, expected, sizeof(*program->kinds));
+    program->data = arena_grow(arena, NULL, 0, &program->node_capacity, expected, sizeof(*program->data));
+    program->children = arena_grow(arena, NULL, 0, &program->child_capacity, expected, sizeof(*program->children));
+    return program;
+}
+
+// Files are only parsed in parallel if every thread gets at least this many tokens.
+#define PARSE_CHUNK_MIN_TOKENS (1 << 16)
+
+// A span of top-level items that is parsed on its own thread, into its own program and errors. The nodes of the items
+// are left on the scratch stack of the parser.
+typedef struct {
+    Parser parser;
+    Noh_Arena arena;
+    Errors errors;
+    pthread_t thread;
+    bool started;
+} ParseChunk;
+
+static void *parse_chunk(void *arg) {
+    ParseChunk *chunk = arg;
+    Parser *parser = &chunk->parser;
+    while (parser->index < parser->tokens.count) parse_item(parser);
+    return NULL;
+}
+
+// Finds the first top-level item that starts at or after the token at the index. A top-level line is preceded by a
+// newline token at the first column, and by the dedents of the blocks of the item before it.
+static size_t next_item_start(Tokens tokens, size_t index) {
+    const char *content = source_file_get(tokens.file_id)->content.elems;
+    for (; index < tokens.count; index++) {
+        if (tokens.types[index] != TokenLayoutNewline) continue;
+
+        uint32 offset = tokens.offsets[index];
+        if (offset > 0 && content[offset - 1] != '\n' && content[offset - 1] != '\r') continue;
+
+        index++;
+        while (index < tokens.count && tokens.types[index] == TokenLayoutDedent) index++;
+        return index;
+    }
+    return tokens.count;
+}
+
+// Moves the nodes of a chunk to the end of the program, and moves the item nodes of the chunk to the scratch stack of
+// the parser of the program. The nodes and children of the chunk are shifted by the nodes and children that are
+// already in the program.
+static void program_append_chunk(Parser *parser, ParseChunk *chunk) {
+    Program *program = parser->program;
+    Program *part = chunk->parser.program;
+    uint32 node_base = program->node_count;
+    uint32 child_base = program->child_count;
+
+    uint32 node_count = node_base + part->node_count;
+    uint32 kinds_capacity = program->node_capacity;
+    program->kinds = arena_grow(program->arena, program->kinds, node_base, &kinds_capacity, node_count,
+                                sizeof(*program->kinds));
+    program->data = arena_grow(program->arena, program->data, node_base, &program->node_capacity, node_count,
+                               sizeof(*program->data));
+    program->children = arena_grow(program->arena, program->children, child_base, &program->child_capacity,
+                                   child_base + part->child_count, sizeof(*program->children));
+
+    memcpy(program->kinds + node_base, part->kinds, part->node_count * sizeof(*part->kinds));
+    for (uint32 i = 0; i < part->node_count; i++) {
+        NodeData data = part->data[i];
+        switch (part->kinds[i]) {
+            case NodeModule:
+            case NodeFunctionDefinition:
+            case NodeFunctionImplementation:
+            case NodeBody:
+                data.first += child_base;
+                break;
+            case NodeStatement:
+            case NodeReturn:
+                data.first += node_base;
+                break;
+            default: break;
+        }
+        program->data[node_base + i] = data;
+    }
+    for (uint32 i = 0; i < part->child_count; i++) program->children[child_base + i] = part->children[i] + node_base;
+    program->node_count = node_count;
+    program->child_count += part->child_count;
+
+    NodeStack *items = &chunk->parser.scratch;
+    for (size_t i = 0; i < items->count; i++) noh_da_append(&parser->scratch, items->elems[i] + node_base);
+}
+
+// Parses the items of a file in chunks of whole top-level items, all but the first on separate threads, each with
+// its own arena. Items do not depend on each other, so the chunks are appended to the program in order afterwards,
+// which gives the same nodes and errors in the same order as parsing on a single thread.
+static void parse_chunks(Parser *parser, size_t chunk_count) {
+    Tokens tokens = parser->tokens;
+    ParseChunk *chunks = calloc(chunk_count, sizeof(*chunks));
+    noh_assert(chunks != NULL && "Could not allocate enough memory");
+
+    size_t start = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        size_t end = i + 1 < chunk_count ? next_item_start(tokens, tokens.count / chunk_count * (i + 1)) : tokens.count;
+        if (end < start) end = start;
+
+        ParseChunk *chunk = &chunks[i];
+        Tokens chunk_tokens = tokens;
+        chunk_tokens.count = end; // Parsing stops at the end of the chunk.
+        if (i == 0) {
+            chunk->parser = *parser;
+            chunk->parser.tokens = chunk_tokens;
+        } else {
+            // Room for the node arrays of the expected number of nodes, which program_init allocates.
+            chunk->arena = noh_arena_init((end - start) * 8 + (1 KB));
+            chunk->parser = (Parser) {
+                .program = program_init(&chunk->arena, tokens, (end - start) / 4),
+                .tokens = chunk_tokens,
+                .index = start,
+                .errors = &chunk->errors,
+                .options = parser->options,
+            };
+        }
+        start = end;
+    }
+
+    for (size_t i = 1; i < chunk_count; i++) {
+        chunks[i].started = pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]) == 0;
+    }
+
+    // The first chunk is parsed on the calling thread, straight into the program.
+    parse_chunk(&chunks[0]);
+    parser->scratch = chunks[0].parser.scratch;
+    parser->index = chunks[0].parser.index;
+
+    for (size_t i = 1; i < chunk_count; i++) {
+        // If the thread of a chunk could not be started, it is parsed here instead.
+        ParseChunk *chunk = &chunks[i];
+        if (chunk->started) pthread_join(chunk->thread, NULL);
+        else parse_chunk(chunk);
+
+        program_append_chunk(parser, chunk);
+        if (chunk->errors.count > 0) noh_da_append_multiple(parser->errors, chunk->errors.elems, chunk->errors.count);
+
+        noh_da_free(&chunk->parser.scratch);
+        noh_da_free(&chunk->errors);
+        noh_arena_free(&chunk->arena);
+    }
+
+    parser->index = tokens.count;
+    free(chunks);
+}
+
+Program *parse_file(Noh_Arena *arena, Tokens tokens, Errors *errors, ParseOptions options) {
+    // There are fewer nodes than tokens, so start with room for a share of the tokens to avoid growing.
+    Program *program = program_init(arena, tokens, tokens.count / 4);
+
+    Parser parser = { .program = program, .tokens = tokens, .index = 0, .errors = errors, .options = options };
+    size_t chunk_count = options.threads;
+    if (chunk_count > tokens.count / PARSE_CHUNK_MIN_TOKENS) chunk_count = tokens.count / PARSE_CHUNK_MIN_TOKENS;
+    if (chunk_count > 1) parse_chunks(&parser, chunk_count);
+    else while (parser.index < tokens.count) parse_item(&parser);
+
+    parser_push_parent_node(&parser, NodeModule, 0, 0);
+    program->root = parser.scratch.elems[0];
+
+    noh_da_free(&parser.scratch);
+    return program;
+}
+
+// Parses a window of layout tokens that holds whole top-level items into a new program in the arena, and calls the
+// callback with every item.
+static void parse_window(Parser *parser, Noh_Arena *arena, Tokens window, ParseItemCallback callback, void *data) {
+    if (window.count == 0) return;
+
+    noh_arena_reset(arena);
+    parser->program = program_init(arena, window, window.count / 4);
+    parser->tokens = window;
+    parser->index = 0;
+    while (parser->index < window.count) parse_item(parser);
+
+    for (size_t i = 0; i < parser->scratch.count; i++) callback(parser->program, parser->scratch.elems[i], data);
+    parser->scratch.count = 0;
+}
+
+void parse_stream(uint32 file_id, Errors *errors, ParseOptions options, ParseItemCallback callback, void *data) {
+    Lexer lexer;
+    lexer_init(&lexer, file_id, errors, (LexOptions) { .skip_line_starts = true });
+    Layout layout;
+    layout_init(&layout, file_id, errors);
+
+    Tokens window = { .file_id = file_id };
+    Noh_Arena arena = noh_arena_init(10 KB);
+    Parser parser = { .errors = errors, .options = options };
+
+    // The depth of the open blocks at the layout tokens up to scanned.
+    size_t depth = 0;
+    size_t scanned = 0;
+    Token token;
+    while (lexer_next(&lexer, &token)) {
+        uint32 offset = token.value.elems - lexer.base;
+        layout_push(&layout, token.type, offset, token.value.count, token.payload, &window);
+        if (token.type == TokenIndent) continue;
+
+        size_t last = window.count - 1;
+        for (; scanned < last; scanned++) {
+            if (window.types[scanned] == TokenLayoutIndent) depth++;
+            else if (window.types[scanned] == TokenLayoutDedent) depth--;
+        }
+        scanned = window.count;
+
+        // A token outside of all blocks at the start of a line starts the next top-level item, so the items before it
+        // are complete.
+        if (depth > 0 || last == 0) continue;
+        if (window.types[last - 1] != TokenLayoutNewline && window.types[last - 1] != TokenLayoutDedent) continue;
+
+        window.count = last;
+        parse_window(&parser, &arena, window, callback, data);
+        window.count = 0;
+        tokens_append(&window, token.type, offset, token.value.count, token.payload);
+        scanned = window.count;
+    }
+
+    layout_finish(&layout, &window);
+    parse_window(&parser, &arena, window, callback, data);
 
-    return &program;
+    noh_da_free(&parser.scratch);
+    noh_arena_free(&arena);
+    tokens_free(&window);
+    lexer_free(&lexer);
 }
@@ -4,43 +4,105 @@
 #include "common.h"
 #include "lexer.h"
 
-// Preprocessor expression.
-typedef struct {
-    Location loc;
-    Token *tokens;
-    size_t token_count;
-} PreProc;
+// The kinds of nodes in the syntax tree.
+typedef enum {
+    NodeModule, // The root of a file, its children are the top-level items.
+    NodePreProc, // A preprocessor directive, its tokens are passed on as they are.
+    NodeFunctionDefinition, // name :: type -> type, its children are the types.
+    NodeFunctionImplementation, // name params = body, its children are the parameters and then the body.
+    NodeType, // A type in a function definition, its tokens are the type.
+    NodeParameter, // A parameter of a function implementation, the main token is its name or ().
+    NodeBody, // The body of a function implementation, its children are the statements.
+    NodeLazyBody, // A body that is not parsed yet, its tokens are the body. See program_get_body.
+    NodeStatement, // An expression statement in a function body.
+    NodeReturn, // A return statement, its expression is the returned value and can be empty.
 
-typedef struct {} FunctionDefinition;
-typedef struct {} FunctionImplementation;
-typedef struct {} Expression;
+    // Expression nodes, the main token is the literal, name or operator.
+    NodeIdentifier,
+    NodeNumberLiteral,
+    NodeStringLiteral,
+    NodeCharLiteral,
+    NodeBoolLiteral,
+    NodeUnit, // ()
+    NodeUnary, // A prefix operator, applied to the value before it.
+    NodeBinary, // An infix operator, applied to the two values before it.
+    NodeCall, // A function applied to count arguments, like printfn "text". The function and arguments come before it.
+} NodeKind;
 
-typedef enum {
-    ST_PreProc,
-    ST_FunctionDefinition,
-    ST_FunctionImplementation,
-    ST_Expression,
-} StatementType;
+// The index of a node in a program. Nodes are referred to by index instead of by pointer, which halves the size of
+// every reference and keeps a program valid when its arrays move.
+typedef uint32 NodeIndex;
 
+// The data of a node, what first and count mean depends on the kind of the node:
+// - Nodes with children: the children are the range of count elements from first in the children of the program.
+// - Nodes with tokens: the tokens are the range of count tokens from first in the tokens of the program.
+// - Statements: the expression is the range of count nodes from first, in postfix order. Every expression node comes
+//   after the nodes of its operands, so an expression is evaluated with a single pass and a stack of values, and its
+//   last node is its root.
 typedef struct {
-    StatementType type;
-    union {
-        PreProc *preproc;
-        FunctionDefinition *fundef;
-        FunctionImplementation *funimpl;
-        Expression *expr;
-    };
-} Statement;
-
+    uint32 token; // The main token of the node, the name of a function or the keyword of a directive or statement.
+    uint32 first;
+    uint32 count;
+} NodeData;
 
+// A syntax tree, stored as flat arrays in an arena. The kind of every node is stored apart from its data, so passes
+// that only look for certain kinds of nodes scan a single byte per node. Since all arrays live in the arena, the
+// program is freed with it at once. A program that is loaded from the cache uses the arrays in the cache entry until
+// it grows.
 typedef struct {
-    Statement *elems;
-    size_t count;
-    size_t capacity;
+    uint8 *kinds; // The kind of every node, indexed by node.
+    NodeData *data; // The data of every node, indexed by node.
+    uint32 node_count;
+    uint32 node_capacity;
+
+    NodeIndex *children; // The children of all nodes, the children of a single node are next to each other.
+    uint32 child_count;
+    uint32 child_capacity;
+
+    NodeIndex root; // The module node.
+    Tokens tokens; // The tokens that the nodes refer to.
+    Noh_Arena *arena;
 } Program;
 
+// Gets the child at the specified index of a node.
+NodeIndex program_child(Program *program, NodeIndex node, uint32 index);
+
+// Gets the main token of a node.
+Token program_token(Program *program, NodeIndex node);
+
+// Gets the token at the specified index in the token range of a node.
+Token program_node_token(Program *program, NodeIndex node, uint32 index);
+
+// Gets the body of a function implementation, which is its last child. A lazy body is parsed first, its nodes are
+// added to the program and its errors are appended to errors. This changes the program, so it should not be called
+// from multiple threads on the same program.
+NodeIndex program_get_body(Program *program, NodeIndex function, Errors *errors);
+
+// Options for parsing a file.
+typedef struct {
+    // The number of threads parse_file may use. The top-level items of a large file are split into chunks that are
+    // parsed in parallel, 0 or 1 parses on the calling thread only.
+    size_t threads;
+    // Whether the bodies of function implementations are only parsed when they are needed, with program_get_body.
+    // The body of every implementation is then a lazy body with only its tokens.
+    bool lazy_bodies;
+} ParseOptions;
+
+// Parses the layout tokens of a file into a syntax tree, which is allocated in the arena.
+// The tokens are referred to by the program, so they should outlive it. The result is the same regardless of the
+// number of threads in the options.
+Program *parse_file(Noh_Arena *arena, Tokens tokens, Errors *errors, ParseOptions options);
+
+// Called by parse_stream for every top-level item of a file. The program holds only the item and the tokens it refers
+// to, it is reused for the next item after the callback returns.
+typedef void (*ParseItemCallback)(Program *program, NodeIndex item, void *data);
 
-// Parses the tokens lexed from a file into a syntax tree.
-Program *parse_file(Noh_Arena *arena, Tokens tokens, Errors *errors);
+// Lexes, lays out and parses a file from the source file table in a single pass, one top-level item at a time, and
+// calls the callback with every item. Only the tokens and nodes of the current item are kept, and the line starts of
+// the file are not filled, so memory is bounded by the largest item instead of the size of the file. The items and
+// errors are the same as the ones from lex_file, layout_tokens and parse_file, but the errors of every item are
+// appended to errors before its callback is called, so the callback can report and remove them. The threads in the
+// options are not used.
+void parse_stream(uint32 file_id, Errors *errors, ParseOptions options, ParseItemCallback callback, void *data);
 
 #endif // _PARSER_H
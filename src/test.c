@@ -0,0 +1,834 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "noh.h"
+#include "common.h"
+#include "lexer.h"
+#include "layout.h"
+#include "parser.h"
+#include "include.h"
+#include "cache.h"
+#include "emit.h"
+#include "codegen.h"
+
+// Checks a condition in a test, and makes the test fail with a message if it does not hold.
+#define check(condition, ...)                   \
+do {                                            \
+    if (!(condition)) {                         \
+        noh_log(NOH_ERROR, __VA_ARGS__);        \
+        return false;                           \
+    }                                           \
+} while (0)
+
+// Pieces of source code that are put together at random, they include everything that makes lexing hard: line
+// endings, unterminated literals, escapes, directives and multichar symbols.
+static const char *pieces[] = {
+    "a", " ", "\n", "\r", "\r\n", "\"", "\\", "'", "#include", "<", ">", "::", "->", "//", "1.5", "  ", "\t", "return",
+    "x", "foo", "bar7", "\"str\"", "= ", "(", ")", "true"
+};
+
+// A xorshift generator, so the tests are the same on every run.
+static uint32 random_state = 2463534242u;
+static uint32 random_next(uint32 bound) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % bound;
+}
+
+// Appends the specified number of random pieces to a source.
+static void random_source(Noh_String *source, size_t count) {
+    for (size_t i = 0; i < count; i++) noh_string_append_cstr(source, pieces[random_next(noh_array_len(pieces))]);
+}
+
+static bool tokens_equal(Tokens a, Tokens b) {
+    check(a.count == b.count, "Expected %zu tokens, got %zu.", a.count, b.count);
+    for (size_t i = 0; i < a.count; i++) {
+        bool same = a.types[i] == b.types[i] && a.offsets[i] == b.offsets[i] && a.lengths[i] == b.lengths[i]
+            && a.payloads[i] == b.payloads[i];
+        check(same, "Token %zu differs.", i);
+    }
+    return true;
+}
+
+// Compares errors, the files of the errors are not compared so the same content can be lexed as another file.
+static bool errors_equal(Errors a, Errors b) {
+    check(a.count == b.count, "Expected %zu errors, got %zu.", a.count, b.count);
+    for (size_t i = 0; i < a.count; i++) {
+        bool same = a.elems[i].type == b.elems[i].type && a.elems[i].loc.offset == b.elems[i].loc.offset
+            && noh_sv_eq(a.elems[i].message, b.elems[i].message);
+        check(same, "Error %zu differs.", i);
+    }
+    return true;
+}
+
+// Tokens that are pulled from a Lexer, and peeked at ahead of it, are the same as the ones lex_file produces.
+static bool test_lexer_pull(void) {
+    for (size_t iteration = 0; iteration < 500; iteration++) {
+        Noh_String source = {0};
+        random_source(&source, random_next(200));
+        uint32 file_id = source_file_add("pull.cr", noh_sv_from_string(&source));
+        LexOptions options = { .keep_trivia = random_next(2) };
+
+        Tokens tokens = {0};
+        Errors errors = {0};
+        lex_file(file_id, &tokens, &errors, options);
+
+        Lexer lexer;
+        Errors pulled_errors = {0};
+        lexer_init(&lexer, file_id, &pulled_errors, options);
+        size_t count = 0;
+        Token token;
+        while (true) {
+            size_t distance = random_next(4);
+            Token peeked;
+            bool has_peeked = lexer_peek(&lexer, distance, &peeked);
+            check(has_peeked == (count + distance < tokens.count), "Peeking %zu ahead of token %zu is wrong.",
+                  distance, count);
+            if (has_peeked) {
+                Token expected = tokens_get(tokens, count + distance);
+                check(peeked.type == expected.type && peeked.loc.offset == expected.loc.offset,
+                      "Peeked token %zu differs.", count + distance);
+            }
+
+            if (!lexer_next(&lexer, &token)) break;
+            Token expected = tokens_get(tokens, count);
+            bool same = token.type == expected.type && token.loc.offset == expected.loc.offset
+                && token.value.count == expected.value.count && token.payload == expected.payload;
+            check(same, "Pulled token %zu differs.", count);
+            count++;
+        }
+        check(count == tokens.count, "Pulled %zu tokens, expected %zu.", count, tokens.count);
+        if (!errors_equal(errors, pulled_errors)) return false;
+
+        lexer_free(&lexer);
+        tokens_free(&tokens);
+        noh_da_free(&errors);
+        noh_da_free(&pulled_errors);
+        noh_string_free(&source);
+    }
+
+    return true;
+}
+
+static bool line_starts_equal(LineStarts a, LineStarts b) {
+    check(a.count == b.count, "Expected %zu lines, got %zu.", a.count, b.count);
+    check(a.count == 0 || memcmp(a.elems, b.elems, a.count * sizeof(*a.elems)) == 0, "The line starts differ.");
+    return true;
+}
+
+// Relexing the lines that an edit touches gives the same tokens, trivia, errors and line starts as lexing the whole
+// edited file again.
+static bool test_relex_edit(void) {
+    for (size_t iteration = 0; iteration < 1000; iteration++) {
+        Noh_String source = {0};
+        random_source(&source, random_next(60));
+        uint32 file_id = source_file_add("edited.cr", noh_sv_from_string(&source));
+        bool side_table = random_next(2);
+        Tokens trivia = {0};
+        LexOptions options = { .keep_trivia = !side_table && random_next(2), .trivia = side_table ? &trivia : NULL };
+
+        Tokens tokens = {0};
+        Errors errors = {0};
+        lex_file(file_id, &tokens, &errors, options);
+
+        for (size_t e = 0; e < 5; e++) {
+            // Replace a few bytes anywhere in the file with a few pieces.
+            size_t count = source_file_get(file_id)->content.count;
+            uint32 start = random_next(count + 1);
+            uint32 end = start + random_next(count - start < 6 ? count - start + 1 : 6);
+            Noh_String replacement = {0};
+            random_source(&replacement, random_next(4));
+            SourceEdit edit = { .start = start, .end = end, .replacement = noh_sv_from_string(&replacement) };
+            relex_edit(&tokens, &errors, options, edit);
+
+            // Lex a copy of the edited content as another file.
+            SourceFile *edited = source_file_get(file_id);
+            Noh_String copy = {0};
+            if (edited->content.count > 0) {
+                noh_da_append_multiple(&copy, edited->content.elems, edited->content.count);
+            }
+            uint32 full_id = source_file_add("full.cr", noh_sv_from_string(&copy));
+            Tokens full_trivia = {0};
+            LexOptions full_options = options;
+            if (side_table) full_options.trivia = &full_trivia;
+            Tokens full_tokens = {0};
+            Errors full_errors = {0};
+            lex_file(full_id, &full_tokens, &full_errors, full_options);
+
+            if (!tokens_equal(full_tokens, tokens) || !errors_equal(full_errors, errors)) return false;
+            if (side_table && !tokens_equal(full_trivia, trivia)) return false;
+            LineStarts edited_lines = source_file_get(file_id)->line_starts;
+            if (!line_starts_equal(source_file_get(full_id)->line_starts, edited_lines)) return false;
+
+            tokens_free(&full_tokens);
+            tokens_free(&full_trivia);
+            noh_da_free(&full_errors);
+            noh_string_free(&replacement);
+            noh_string_free(&copy);
+        }
+
+        tokens_free(&tokens);
+        tokens_free(&trivia);
+        noh_da_free(&errors);
+        noh_string_free(&source);
+    }
+
+    return true;
+}
+
+// Lexing a large file in parallel chunks gives the same tokens, trivia, errors and line starts as lexing it on a
+// single thread, whether trivia is kept in the stream, moved to a side table or dropped.
+static bool test_parallel_lex(void) {
+    // Large enough for several chunks, see LEX_CHUNK_MIN_SIZE.
+    Noh_String source = {0};
+    while (source.count < 5 MB) random_source(&source, 1000);
+    uint32 file_id = source_file_add("parallel.cr", noh_sv_from_string(&source));
+
+    for (size_t mode = 0; mode < 3; mode++) {
+        Tokens serial_trivia = {0};
+        LexOptions options = { .keep_trivia = mode == 0, .trivia = mode == 1 ? &serial_trivia : NULL };
+        Tokens serial = {0};
+        Errors serial_errors = {0};
+        lex_file(file_id, &serial, &serial_errors, options);
+        LineStarts serial_lines = {0};
+        LineStarts lines = source_file_get(file_id)->line_starts;
+        noh_da_append_multiple(&serial_lines, lines.elems, lines.count);
+
+        size_t thread_counts[] = { 2, 3, 4, 7 };
+        for (size_t i = 0; i < noh_array_len(thread_counts); i++) {
+            Tokens trivia = {0};
+            LexOptions parallel_options = options;
+            parallel_options.threads = thread_counts[i];
+            if (mode == 1) parallel_options.trivia = &trivia;
+            Tokens tokens = {0};
+            Errors errors = {0};
+            lex_file(file_id, &tokens, &errors, parallel_options);
+
+            if (!tokens_equal(serial, tokens) || !errors_equal(serial_errors, errors)) return false;
+            if (!tokens_equal(serial_trivia, trivia)) return false;
+            if (!line_starts_equal(serial_lines, source_file_get(file_id)->line_starts)) return false;
+
+            tokens_free(&tokens);
+            tokens_free(&trivia);
+            noh_da_free(&errors);
+        }
+
+        tokens_free(&serial);
+        tokens_free(&serial_trivia);
+        noh_da_free(&serial_errors);
+        noh_da_free(&serial_lines);
+    }
+
+    noh_string_free(&source);
+    return true;
+}
+
+static bool token_is_layout(Tokens tokens, size_t index) {
+    TokenType type = tokens.types[index];
+    return type == TokenLayoutNewline || type == TokenLayoutIndent || type == TokenLayoutDedent;
+}
+
+// Describes layout tokens by their values separated by spaces, with ; for a newline, { for an indent and } for a
+// dedent.
+static void describe_layout(Noh_String *out, Tokens layout) {
+    for (size_t i = 0; i < layout.count; i++) {
+        if (i > 0) noh_da_append(out, ' ');
+        switch (layout.types[i]) {
+            case TokenLayoutNewline: noh_da_append(out, ';'); break;
+            case TokenLayoutIndent: noh_da_append(out, '{'); break;
+            case TokenLayoutDedent: noh_da_append(out, '}'); break;
+            default: {
+                Noh_String_View value = tokens_get(layout, i).value;
+                if (value.count > 0) noh_da_append_multiple(out, value.elems, value.count);
+            } break;
+        }
+    }
+}
+
+// A small source and the layout it should get.
+typedef struct {
+    const char *source;
+    const char *layout;
+    // Where the layout error is, or -1 if the layout is valid.
+    int error_offset;
+} LayoutCase;
+
+static LayoutCase layout_cases[] = {
+    { "", "", -1 },
+    { "\n\n", "", -1 },
+    { "a\nb\n", "a ; b ;", -1 },
+    { "a\nb", "a ; b ;", -1 },
+    // Blocks that are open at the end of the file are closed there.
+    { "f\n  a\n    b\n", "f ; { a ; { b ; } }", -1 },
+    { "f\n  a\n    b\n  c\nd\n", "f ; { a ; { b ; } c ; } d ;", -1 },
+    { "  a\nb\n", "{ a ; } b ;", -1 },
+    // A width between two open blocks ends the inner block and starts a new one.
+    { "f\n    a\n  b\nc\n", "f ; { a ; } { b ; } c ;", 10 },
+    { "f\n  a\n      b\n    c\n", "f ; { a ; { b ; } { c ; } }", 18 },
+    // Blank, whitespace-only and comment-only lines do not take part in the layout.
+    { "f\n\n  a\n   \n  b\n\n", "f ; { a ; b ; }", -1 },
+    { "f\n  a\n// note\n      // deeper note\n  b\n", "f ; { a ; b ; }", -1 },
+    { "f\r\n  a\r\n\r\n  b\r\n", "f ; { a ; b ; }", -1 },
+    // A tab is a single column, the lexer reports it.
+    { "f\n\ta\n\tb\n", "f ; { a ; b ; }", -1 },
+    { "f\n\t a\n  b\n", "f ; { a ; b ; }", -1 },
+};
+
+// The layout tokens of small sources are exactly the expected newlines, indents and dedents, and every virtual token
+// is placed at the first token of its line or at the end of the file.
+static bool test_layout(void) {
+    for (size_t i = 0; i < noh_array_len(layout_cases); i++) {
+        LayoutCase c = layout_cases[i];
+        uint32 file_id = source_file_add("layout.cr", noh_sv_from_cstr(c.source));
+        Tokens tokens = {0};
+        Tokens layout = {0};
+        Errors lex_errors = {0};
+        Errors errors = {0};
+        lex_file(file_id, &tokens, &lex_errors, (LexOptions) {0});
+        layout_tokens(tokens, &layout, &errors);
+
+        Noh_String description = {0};
+        describe_layout(&description, layout);
+        check(noh_sv_eq(noh_sv_from_string(&description), noh_sv_from_cstr(c.layout)),
+              "Case %zu: expected layout '%s', got '" Nsv_Fmt "'.", i, c.layout, Nsv_Arg(description));
+
+        if (c.error_offset < 0) {
+            check(errors.count == 0, "Case %zu: expected no layout errors, got %zu.", i, errors.count);
+        } else {
+            check(errors.count == 1 && errors.elems[0].type == LayoutError
+                  && errors.elems[0].loc.offset == (uint32)c.error_offset,
+                  "Case %zu: expected a layout error at %d.", i, c.error_offset);
+        }
+
+        uint32 end = strlen(c.source);
+        for (size_t j = 0; j < layout.count; j++) {
+            if (!token_is_layout(layout, j)) continue;
+            size_t next = j;
+            while (next < layout.count && token_is_layout(layout, next)) next++;
+            uint32 expected = next < layout.count ? layout.offsets[next] : end;
+            check(layout.offsets[j] == expected, "Case %zu: layout token %zu is at %u instead of %u.", i, j,
+                  layout.offsets[j], expected);
+        }
+
+        noh_string_free(&description);
+        noh_da_free(&errors);
+        noh_da_free(&lex_errors);
+        tokens_free(&layout);
+        tokens_free(&tokens);
+    }
+
+    return true;
+}
+
+// Appends a program with the specified number of functions to a source. The functions have statements of different
+// shapes, and call the function before them. With errors, some statements are broken.
+static void generate_program(Noh_String *source, size_t function_count, bool errors) {
+    Noh_Arena arena = noh_arena_init(1 KB);
+    for (size_t i = 0; i < function_count; i++) {
+        if (i % 97 == 0) noh_string_append_cstr(source, "#include <stdlib.h>\n");
+        noh_string_append_cstr(source, noh_arena_sprintf(&arena, "f%zu :: int -> int -> int\nf%zu x y =\n", i, i));
+
+        size_t statement_count = 1 + random_next(4);
+        for (size_t j = 0; j < statement_count; j++) {
+            switch (random_next(4)) {
+                case 0: noh_string_append_cstr(source, "    x = -x * (y + 3) - 2 == 3 && !y\n"); break;
+                case 1: noh_string_append_cstr(source, "    printfn \"value %d\\n\" (x + 1) * 2\n"); break;
+                case 2: noh_string_append_cstr(source, "    y = 'c' + 1.5 / (x - y)\n"); break;
+                case 3: {
+                    if (i == 0) break;
+                    noh_string_append_cstr(source, noh_arena_sprintf(&arena, "    y = f%zu x (y + 1)\n", i - 1));
+                } break;
+            }
+            if (errors && random_next(50) == 0) noh_string_append_cstr(source, "    x = (y + \n");
+        }
+        noh_string_append_cstr(source, "    return x - y\n\n");
+        noh_arena_reset(&arena);
+    }
+    noh_arena_free(&arena);
+}
+
+static bool programs_equal(Program *a, Program *b) {
+    check(a->node_count == b->node_count, "Expected %u nodes, got %u.", a->node_count, b->node_count);
+    check(a->child_count == b->child_count, "Expected %u children, got %u.", a->child_count, b->child_count);
+    check(a->root == b->root, "The roots differ.");
+    check(memcmp(a->kinds, b->kinds, a->node_count * sizeof(*a->kinds)) == 0, "The node kinds differ.");
+    check(memcmp(a->data, b->data, a->node_count * sizeof(*a->data)) == 0, "The node data differs.");
+    check(memcmp(a->children, b->children, a->child_count * sizeof(*a->children)) == 0, "The children differ.");
+    return true;
+}
+
+// Parsing a large file in parallel chunks gives the same program and errors as parsing it on a single thread, with
+// and without lazy bodies and with and without syntax errors.
+static bool test_parallel_parse(void) {
+    for (size_t mode = 0; mode < 4; mode++) {
+        // Large enough for several chunks, see PARSE_CHUNK_MIN_TOKENS.
+        Noh_String source = {0};
+        generate_program(&source, 12000, mode >= 2);
+        uint32 file_id = source_file_add("parse.cr", noh_sv_from_string(&source));
+        Tokens tokens = {0};
+        Tokens layout = {0};
+        Errors lex_errors = {0};
+        lex_file(file_id, &tokens, &lex_errors, (LexOptions) {0});
+        layout_tokens(tokens, &layout, &lex_errors);
+        check(lex_errors.count == 0, "The generated program has %zu lexer or layout errors.", lex_errors.count);
+
+        ParseOptions options = { .threads = 1, .lazy_bodies = mode % 2 == 1 };
+        Noh_Arena serial_arena = noh_arena_init(1 MB);
+        Errors serial_errors = {0};
+        Program *serial = parse_file(&serial_arena, layout, &serial_errors, options);
+        check((serial_errors.count > 0) == (mode == 2), "The generated program has %zu parse errors.",
+              serial_errors.count);
+
+        size_t thread_counts[] = { 2, 3, 4, 7 };
+        for (size_t i = 0; i < noh_array_len(thread_counts); i++) {
+            options.threads = thread_counts[i];
+            Noh_Arena arena = noh_arena_init(1 MB);
+            Errors errors = {0};
+            Program *program = parse_file(&arena, layout, &errors, options);
+            if (!programs_equal(serial, program) || !errors_equal(serial_errors, errors)) return false;
+
+            noh_da_free(&errors);
+            noh_arena_free(&arena);
+        }
+
+        noh_arena_free(&serial_arena);
+        noh_da_free(&serial_errors);
+        noh_da_free(&lex_errors);
+        tokens_free(&layout);
+        tokens_free(&tokens);
+        noh_string_free(&source);
+    }
+
+    return true;
+}
+
+// Appends a description of a node and all nodes below it to a string, with the offsets of their tokens instead of the
+// token indices, so items of programs with different tokens can be compared.
+static void describe_node(Noh_String *out, Program *program, NodeIndex node) {
+    NodeData data = program->data[node];
+    uint32 *offsets = program->tokens.offsets;
+    NodeKind kind = program->kinds[node];
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "(%u %u %u", kind, offsets[data.token], data.count);
+    noh_string_append_cstr(out, buffer);
+    switch (kind) {
+        case NodeModule:
+        case NodeFunctionDefinition:
+        case NodeFunctionImplementation:
+        case NodeBody:
+            for (uint32 i = 0; i < data.count; i++) describe_node(out, program, program_child(program, node, i));
+            break;
+        case NodeStatement:
+        case NodeReturn:
+            for (uint32 i = 0; i < data.count; i++) {
+                NodeData expr = program->data[data.first + i];
+                snprintf(buffer, sizeof(buffer), " %u:%u:%u", program->kinds[data.first + i], offsets[expr.token],
+                         expr.count);
+                noh_string_append_cstr(out, buffer);
+            }
+            break;
+        default:
+            for (uint32 i = 0; i < data.count; i++) {
+                snprintf(buffer, sizeof(buffer), " %u", offsets[data.first + i]);
+                noh_string_append_cstr(out, buffer);
+            }
+            break;
+    }
+    noh_string_append_cstr(out, ")");
+}
+
+static void describe_streamed_item(Program *program, NodeIndex item, void *data) {
+    describe_node(data, program, item);
+}
+
+// Orders errors by location, then by type and message.
+static int error_compare(const void *a, const void *b) {
+    const Error *x = a;
+    const Error *y = b;
+    if (x->loc.offset != y->loc.offset) return x->loc.offset < y->loc.offset ? -1 : 1;
+    if (x->type != y->type) return x->type < y->type ? -1 : 1;
+    size_t count = x->message.count < y->message.count ? x->message.count : y->message.count;
+    int result = memcmp(x->message.elems, y->message.elems, count);
+    if (result != 0) return result;
+    return x->message.count < y->message.count ? -1 : x->message.count > y->message.count;
+}
+
+// Streaming a file through parse_stream gives the same items and errors as lexing, laying out and parsing it at once,
+// for programs with syntax errors and for random sources with broken layout.
+static bool test_parse_stream(void) {
+    for (size_t mode = 0; mode < 4; mode++) {
+        Noh_String source = {0};
+        if (mode < 2) generate_program(&source, 300, true);
+        else random_source(&source, 20000);
+        uint32 file_id = source_file_add("stream.cr", noh_sv_from_string(&source));
+        ParseOptions options = { .lazy_bodies = mode % 2 == 1 };
+
+        Noh_String streamed = {0};
+        Errors streamed_errors = {0};
+        parse_stream(file_id, &streamed_errors, options, describe_streamed_item, &streamed);
+        check(source_file_get(file_id)->line_starts.count == 0, "Streaming filled the line starts.");
+
+        Tokens tokens = {0};
+        Tokens layout = {0};
+        Errors errors = {0};
+        lex_file(file_id, &tokens, &errors, (LexOptions) {0});
+        layout_tokens(tokens, &layout, &errors);
+        Noh_Arena arena = noh_arena_init(1 MB);
+        Program *program = parse_file(&arena, layout, &errors, options);
+        Noh_String items = {0};
+        for (uint32 i = 0; i < program->data[program->root].count; i++) {
+            describe_node(&items, program, program_child(program, program->root, i));
+        }
+        check(mode >= 2 || program->data[program->root].count > 300, "The generated program has too few items.");
+
+        check(noh_sv_eq(noh_sv_from_string(&items), noh_sv_from_string(&streamed)), "The streamed items differ.");
+        if (errors.count > 0) qsort(errors.elems, errors.count, sizeof(*errors.elems), error_compare);
+        if (streamed_errors.count > 0) {
+            qsort(streamed_errors.elems, streamed_errors.count, sizeof(*streamed_errors.elems), error_compare);
+        }
+        if (!errors_equal(errors, streamed_errors)) return false;
+
+        noh_string_free(&items);
+        noh_arena_free(&arena);
+        noh_da_free(&errors);
+        tokens_free(&layout);
+        tokens_free(&tokens);
+        noh_da_free(&streamed_errors);
+        noh_string_free(&streamed);
+        noh_string_free(&source);
+    }
+
+    return true;
+}
+
+// Lexes, lays out and parses a file, with lazy bodies so a loaded program has bodies left to parse.
+static Program *compile_file(Noh_Arena *arena, uint32 file_id, Tokens *tokens, Tokens *layout, Errors *errors) {
+    lex_file(file_id, tokens, errors, (LexOptions) {0});
+    layout_tokens(*tokens, layout, errors);
+    return parse_file(arena, *layout, errors, (ParseOptions) { .lazy_bodies = true });
+}
+
+// Inverts the byte at an offset in a file, counted from the end of the file if the offset is negative.
+static bool file_flip_byte(const char *path, long offset) {
+    FILE *file = fopen(path, "r+b");
+    check(file != NULL, "Could not open file %s: %s", path, strerror(errno));
+    fseek(file, offset, offset < 0 ? SEEK_END : SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, offset, offset < 0 ? SEEK_END : SEEK_SET);
+    fputc(c ^ 0xff, file);
+    fclose(file);
+    return true;
+}
+
+// Checks that the cache entry of a file is rejected, and that the results are then left untouched.
+static bool cache_rejects(uint32 file_id, Noh_Arena *arena, const char *reason) {
+    Tokens tokens = {0};
+    Tokens layout = {0};
+    Program *program = NULL;
+    check(!cache_load(file_id, arena, &tokens, &layout, &program), "A cache entry %s is loaded.", reason);
+    check(tokens.count == 0 && layout.count == 0 && program == NULL, "A rejected cache entry %s changed results.",
+          reason);
+    return true;
+}
+
+// Storing a file in the cache and loading it again gives the same tokens, layout tokens, line starts and program as
+// compiling it, and the loaded tokens and program, which borrow their arrays from the entry, can still grow. Entries
+// that are corrupted, cut short or written for other content are rejected.
+static bool test_cache(void) {
+    Noh_String source = {0};
+    generate_program(&source, 200, false);
+    uint32 file_id = source_file_add("cached.cr", noh_sv_from_string(&source));
+    Noh_Arena arena = noh_arena_init(1 MB);
+    Tokens tokens = {0};
+    Tokens layout = {0};
+    Errors errors = {0};
+    Program *program = compile_file(&arena, file_id, &tokens, &layout, &errors);
+    check(errors.count == 0, "The generated program has %zu errors.", errors.count);
+    LineStarts lines = {0};
+    LineStarts file_lines = source_file_get(file_id)->line_starts;
+    noh_da_append_multiple(&lines, file_lines.elems, file_lines.count);
+    check(cache_store(file_id, tokens, layout, program), "Could not store the cache entry.");
+
+    noh_da_reset(&source_file_get(file_id)->line_starts);
+    Tokens loaded_tokens = {0};
+    Tokens loaded_layout = {0};
+    Program *loaded = NULL;
+    check(cache_load(file_id, &arena, &loaded_tokens, &loaded_layout, &loaded), "Could not load the cache entry.");
+    check(loaded_tokens.capacity == 0 && loaded_layout.capacity == 0, "The loaded tokens do not borrow their arrays.");
+    if (!tokens_equal(tokens, loaded_tokens) || !tokens_equal(layout, loaded_layout)) return false;
+    if (!line_starts_equal(lines, source_file_get(file_id)->line_starts)) return false;
+    if (!programs_equal(program, loaded)) return false;
+
+    // Parsing the lazy bodies adds nodes to the loaded program, which moves its arrays out of the entry.
+    uint32 node_count = program->node_count;
+    for (NodeIndex node = 0; node < node_count; node++) {
+        if (program->kinds[node] != NodeFunctionImplementation) continue;
+        program_get_body(program, node, &errors);
+        program_get_body(loaded, node, &errors);
+    }
+    check(loaded->node_count > node_count, "No lazy bodies were parsed.");
+    if (!programs_equal(program, loaded)) return false;
+
+    // Appending to a borrowed stream copies its arrays first.
+    tokens_append(&tokens, TokenIdentifier, 0, 1, tokens.payloads[0]);
+    tokens_append(&loaded_tokens, TokenIdentifier, 0, 1, tokens.payloads[0]);
+    check(loaded_tokens.capacity > 0, "The appended stream still borrows its arrays.");
+    if (!tokens_equal(tokens, loaded_tokens)) return false;
+
+    // Splicing relexed lines into a borrowed stream gives the same tokens as lexing the edited file.
+    Tokens spliced = {0};
+    Tokens spliced_layout = {0};
+    Program *spliced_program = NULL;
+    check(cache_load(file_id, &arena, &spliced, &spliced_layout, &spliced_program), "Could not load the entry again.");
+    uint32 middle = source.count / 2;
+    SourceEdit edit = { .start = middle, .end = middle + 3, .replacement = noh_sv_from_cstr("(a + b)\n") };
+    relex_edit(&spliced, &errors, (LexOptions) {0}, edit);
+    SourceFile *edited = source_file_get(file_id);
+    Noh_String copy = {0};
+    noh_da_append_multiple(&copy, edited->content.elems, edited->content.count);
+    uint32 full_id = source_file_add("full.cr", noh_sv_from_string(&copy));
+    Tokens full_tokens = {0};
+    Errors full_errors = {0};
+    lex_file(full_id, &full_tokens, &full_errors, (LexOptions) {0});
+    if (!tokens_equal(full_tokens, spliced) || !errors_equal(full_errors, errors)) return false;
+
+    // The entries are changed on disk below, so nothing may point into them anymore.
+    cache_close();
+    tokens_free(&spliced);
+    tokens_free(&full_tokens);
+    tokens_free(&loaded_tokens);
+    tokens_free(&layout);
+    tokens_free(&tokens);
+    noh_da_free(&full_errors);
+    noh_da_free(&errors);
+    noh_da_free(&lines);
+
+    // Corrupt a fresh entry of the unedited source in several ways, each must be rejected.
+    uint32 stored_id = source_file_add("stored.cr", noh_sv_from_string(&source));
+    program = compile_file(&arena, stored_id, &tokens, &layout, &errors);
+    char *path = cache_entry_path(&arena, stored_id);
+    struct stat info;
+
+    check(cache_store(stored_id, tokens, layout, program), "Could not store the cache entry.");
+    if (!file_flip_byte(path, 0) || !cache_rejects(stored_id, &arena, "with a corrupted header")) return false;
+
+    // The content of the file is the last section of the entry.
+    check(cache_store(stored_id, tokens, layout, program), "Could not store the cache entry.");
+    if (!file_flip_byte(path, -1) || !cache_rejects(stored_id, &arena, "for other content")) return false;
+
+    check(cache_store(stored_id, tokens, layout, program), "Could not store the cache entry.");
+    check(stat(path, &info) == 0 && truncate(path, info.st_size / 2) == 0, "Could not cut the entry short.");
+    if (!cache_rejects(stored_id, &arena, "that is cut short")) return false;
+
+    // An entry that is left at the path of another file after its content changed.
+    check(cache_store(stored_id, tokens, layout, program), "Could not store the cache entry.");
+    char *stale_path = cache_entry_path(&arena, file_id);
+    check(rename(path, stale_path) == 0, "Could not move the entry.");
+    if (!cache_rejects(file_id, &arena, "of other content")) return false;
+    remove(stale_path);
+
+    noh_da_free(&errors);
+    tokens_free(&layout);
+    tokens_free(&tokens);
+    noh_arena_free(&arena);
+    noh_string_free(&copy);
+    noh_string_free(&source);
+    return true;
+}
+
+// Generates the code of a unit on the specified number of threads, and returns it in text.
+static void generate_code(Programs programs, size_t threads, Noh_String *text, Errors *errors) {
+    Emitter emitter;
+    emitter_init(&emitter, -1);
+    codegen_unit(programs, &emitter, errors, (CodegenOptions) { .threads = threads });
+    emitter_take(&emitter, text);
+    emitter_free(&emitter);
+}
+
+// Generating code on several threads gives exactly the same code as generating it on a single thread, also for lazy
+// bodies and when the code is split into parts.
+static bool test_parallel_codegen(void) {
+    // Large enough for several chunks, see CODEGEN_CHUNK_MIN_WEIGHT.
+    Noh_String source = {0};
+    generate_program(&source, 12000, false);
+    uint32 file_id = source_file_add("codegen.cr", noh_sv_from_string(&source));
+    Tokens tokens = {0};
+    Tokens layout = {0};
+    Errors errors = {0};
+    lex_file(file_id, &tokens, &errors, (LexOptions) {0});
+    layout_tokens(tokens, &layout, &errors);
+    Noh_Arena arena = noh_arena_init(1 MB);
+    Program *program = parse_file(&arena, layout, &errors, (ParseOptions) {0});
+    Programs programs = {0};
+    noh_da_append(&programs, program);
+
+    Noh_String serial = {0};
+    generate_code(programs, 1, &serial, &errors);
+    check(errors.count == 0, "The generated program has %zu errors.", errors.count);
+
+    size_t thread_counts[] = { 2, 3, 4, 7 };
+    Noh_String text = {0};
+    for (size_t i = 0; i < noh_array_len(thread_counts); i++) {
+        noh_string_reset(&text);
+        generate_code(programs, thread_counts[i], &text, &errors);
+        check(noh_sv_eq(noh_sv_from_string(&serial), noh_sv_from_string(&text)),
+              "The code generated on %zu threads differs.", thread_counts[i]);
+    }
+
+    // Lazy bodies are parsed before the code is generated.
+    Noh_Arena lazy_arena = noh_arena_init(1 MB);
+    programs.elems[0] = parse_file(&lazy_arena, layout, &errors, (ParseOptions) { .lazy_bodies = true });
+    noh_string_reset(&text);
+    generate_code(programs, 3, &text, &errors);
+    check(noh_sv_eq(noh_sv_from_string(&serial), noh_sv_from_string(&text)), "The code for lazy bodies differs.");
+
+    // The header followed by the parts without their include is the code of the whole unit.
+    Emitter header;
+    emitter_init(&header, -1);
+    Emitter parts[5];
+    for (size_t i = 0; i < noh_array_len(parts); i++) emitter_init(&parts[i], -1);
+    codegen_split(programs, &header, "unit.h", parts, noh_array_len(parts), &errors, (CodegenOptions) { .threads = 2 });
+    noh_string_reset(&text);
+    emitter_take(&header, &text);
+    emitter_free(&header);
+    Noh_String_View include = noh_sv_from_cstr("#include \"unit.h\"\n");
+    for (size_t i = 0; i < noh_array_len(parts); i++) {
+        Noh_String part = {0};
+        emitter_take(&parts[i], &part);
+        emitter_free(&parts[i]);
+        check(noh_sv_starts_with(noh_sv_from_string(&part), include), "Part %zu does not include the header.", i);
+        noh_da_append_multiple(&text, part.elems + include.count, part.count - include.count);
+        noh_string_free(&part);
+    }
+    check(noh_sv_eq(noh_sv_from_string(&serial), noh_sv_from_string(&text)), "The split code differs.");
+    check(errors.count == 0, "Generating code gave %zu errors.", errors.count);
+
+    noh_string_free(&text);
+    noh_string_free(&serial);
+    noh_da_free(&programs);
+    noh_arena_free(&lazy_arena);
+    noh_arena_free(&arena);
+    noh_da_free(&errors);
+    tokens_free(&layout);
+    tokens_free(&tokens);
+    noh_string_free(&source);
+    return true;
+}
+
+// A source and the exact C code that is generated for it.
+typedef struct {
+    char *filename; // The source is read from this file if the source is NULL.
+    const char *source;
+    const char *code;
+} CodegenCase;
+
+static CodegenCase codegen_cases[] = {
+    {
+        .filename = "./examples/hello_world.cr",
+        .code =
+            "#include <stdbool.h>\n"
+            "#include <stdio.h>\n"
+            "#define printfn printf\n"
+            "#include <stdio.h> // Yeah!\n"
+            "int main(void);\n"
+            "\n"
+            "int main(void) {\n"
+            "    printfn(\"Hello, World!\\n\");\n"
+            "    return 0;\n"
+            "}\n"
+    },
+    {
+        // Nested operators are put back in infix order with parentheses, = is right associative and prefix operators
+        // bind tighter than infix ones.
+        .filename = "expressions.cr",
+        .source =
+            "f :: int -> int -> int\n"
+            "f a b =\n"
+            "    x = y = -(a + b) * !c\n"
+            "    x = a - (b - c) - d\n"
+            "    y = - - a * (b = c)\n"
+            "    printfn \"%d\\n\" (g a (b + 1)) - h\n"
+            "    return a == b || !(a < b && c)\n",
+        .code =
+            "#include <stdbool.h>\n"
+            "#include <stdio.h>\n"
+            "#define printfn printf\n"
+            "int f(int, int);\n"
+            "\n"
+            "int f(int a, int b) {\n"
+            "    x = (y = ((-(a + b)) * (!c)));\n"
+            "    x = ((a - (b - c)) - d);\n"
+            "    y = ((-(-a)) * (b = c));\n"
+            "    printfn(\"%d\\n\", g(a, b + 1)) - h;\n"
+            "    return (a == b) || (!((a < b) && c));\n"
+            "}\n"
+    },
+};
+
+// The generated code for small sources is exactly the expected C code.
+static bool test_codegen_output(void) {
+    for (size_t i = 0; i < noh_array_len(codegen_cases); i++) {
+        CodegenCase c = codegen_cases[i];
+        uint32 file_id;
+        if (c.source != NULL) file_id = source_file_add(c.filename, noh_sv_from_cstr(c.source));
+        else check(source_file_open(c.filename, &file_id), "Could not open %s.", c.filename);
+
+        Noh_Arena arena = noh_arena_init(1 KB);
+        Tokens tokens = {0};
+        Tokens layout = {0};
+        Errors errors = {0};
+        lex_file(file_id, &tokens, &errors, (LexOptions) {0});
+        layout_tokens(tokens, &layout, &errors);
+        Programs programs = {0};
+        noh_da_append(&programs, parse_file(&arena, layout, &errors, (ParseOptions) {0}));
+        Noh_String code = {0};
+        generate_code(programs, 1, &code, &errors);
+
+        check(errors.count == 0, "%s: generating code gave %zu errors.", c.filename, errors.count);
+        check(noh_sv_eq(noh_sv_from_string(&code), noh_sv_from_cstr(c.code)),
+              "%s: expected the code\n%s\ngot\n" Nsv_Fmt, c.filename, c.code, Nsv_Arg(code));
+
+        noh_string_free(&code);
+        noh_da_free(&programs);
+        noh_da_free(&errors);
+        tokens_free(&layout);
+        tokens_free(&tokens);
+        noh_arena_free(&arena);
+    }
+
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    bool (*run)(void);
+} Test;
+
+static Test tests[] = {
+    { "lexer_pull", test_lexer_pull },
+    { "relex_edit", test_relex_edit },
+    { "parallel_lex", test_parallel_lex },
+    { "layout", test_layout },
+    { "parallel_parse", test_parallel_parse },
+    { "parse_stream", test_parse_stream },
+    { "cache", test_cache },
+    { "codegen_output", test_codegen_output },
+    { "parallel_codegen", test_parallel_codegen },
+};
+
+int main(void) {
+    size_t failed = 0;
+    for (size_t i = 0; i < noh_array_len(tests); i++) {
+        bool passed = tests[i].run();
+        noh_log(passed ? NOH_INFO : NOH_ERROR, "%s: %s", tests[i].name, passed ? "passed" : "failed");
+        if (!passed) failed++;
+    }
+
+    if (failed > 0) {
+        noh_log(NOH_ERROR, "%zu of %zu tests failed.", failed, noh_array_len(tests));
+        return 1;
+    }
+    noh_log(NOH_INFO, "All %zu tests passed.", noh_array_len(tests));
+    return 0;
+}